@@ -0,0 +1,296 @@
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include <string.h>
+
+#include "operations.h"
+#include "order_command.h"
+#include "result.h"
+#include "binary_protocol.h"
+
+#define DEBUG           0
+
+
+
+/*   little-endian unsigned integer of size bytes   */
+// assembled byte by byte, the message needs not be aligned
+unsigned long long get_le (const char* p, int size) {
+  unsigned long long value = 0;
+  for (int i = size - 1; i >= 0; --i) {
+    value = (value << 8) | (unsigned char)p[i];
+  }
+  return value;
+}
+
+
+
+
+
+
+/*   append value as a little-endian integer of size bytes   */
+void put_le (std::string* out, unsigned long long value, int size) {
+  for (int i = 0; i < size; ++i) {
+    out->push_back((char)(value & 0xff));
+    value >>= 8;
+  }
+  return;
+}
+
+
+
+
+
+
+/*   one result or item record   */
+void put_record (std::string* out, int kind, int error, std::size_t items,
+                 long long id, long long amount, long long price, long long time) {
+  put_le(out, kind, 1);
+  put_le(out, error, 1);
+  put_le(out, 0, 2);
+  put_le(out, items, 4);
+  put_le(out, id, 8);
+  put_le(out, amount, 8);
+  put_le(out, price, 8);
+  put_le(out, time, 8);
+  return;
+}
+
+
+
+
+
+
+/*   response message with the results in the order of the request   */
+void render_binary (const result_slots& results, std::string* response) {
+  std::size_t size = BIN_RESPONSE_HEAD;
+
+  for (std::size_t i = 0; i < results.size(); ++i) {
+    size += BIN_RESULT_SIZE * (1 + results[i].items.size());
+  }
+  response->reserve(size);
+  put_le(response, BIN_RESPONSE, 1);
+  put_le(response, BIN_OK, 1);
+  put_le(response, 0, 2);
+  put_le(response, results.size(), 4);
+  for (std::size_t i = 0; i < results.size(); ++i) {
+    const op_result& res = results[i];
+    put_record(response, res.kind, res.error, res.items.size(),
+               res.id, res.amount, res.price, 0);
+    for (std::size_t j = 0; j < res.items.size(); ++j) {
+      const result_item& item = res.items[j];
+      put_record(response, item.kind, item.error, 0,
+                 item.id, item.shares, item.price, item.time);
+    }
+  }
+  return;
+}
+
+
+
+
+
+
+/*   response message without results   */
+void put_status (std::string* response, int status) {
+  response->clear();
+  put_le(response, BIN_RESPONSE, 1);
+  put_le(response, status, 1);
+  put_le(response, 0, 2);
+  put_le(response, 0, 4);
+  return;
+}
+
+
+
+
+
+
+/*   response without results for the event loop, busy or invalid   */
+std::string* binary_status (int status) {
+  std::string* response = new std::string;
+  put_status(response, status);
+  return response;
+}
+
+
+
+
+
+
+/*   NUL padded symbol of a record, false if it is empty   */
+// sets sym_id, or sym for a symbol which is not interned (decode_symbol)
+bool record_symbol (const char* rec, int& sym_id, std::string& sym) {
+  text_view text;
+  text.ptr = rec + 24;
+  text.len = strnlen(text.ptr, BIN_SYM_SIZE);
+  if (text.len == 0) {
+    return false;
+  }
+  decode_symbol(text, sym_id, sym);
+  return true;
+}
+
+
+
+
+
+
+/*   records of a BIN_CREATE message   */
+// returns -1 if a record is not allowed in a create
+int decode_create (const char* rec, long long count, std::vector<create_command>& cmds,
+                   result_slots* results) {
+  for (long long i = 0; i < count; ++i, rec += BIN_RECORD_SIZE) {
+    int op = (unsigned char)rec[0];
+    create_command cmd;
+    cmd.result = add_slot(results);
+    cmd.sym_id = -1;
+
+    if (op == BIN_ACCOUNT) {
+      cmd.type = CHILD_ACCOUNT;
+      cmd.account.account_id = get_le(rec + 8, 8);
+      cmd.account.balance = get_le(rec + 16, 8);
+      int stat = check_account(cmd.account);
+      if (stat != DECODE_OK) {
+        *cmd.result = make_result(RESULT_ERROR, stat == DECODE_ID ?
+                                  ERR_ACCOUNT_NUMBER : ERR_BALANCE,
+                                  cmd.account.account_id);
+        continue;
+      }
+    }
+    else if (op == BIN_SHARES) { // one account per symbol
+      share_command share;
+      cmd.type = CHILD_SYMBOL;
+      share.account_id = get_le(rec + 8, 8);
+      share.shares = get_le(rec + 16, 8);
+      cmd.shares.push_back(share);
+      if (!record_symbol(rec, cmd.sym_id, cmd.sym)) {
+        *cmd.result = make_result(RESULT_SYMBOL, ERR_NONE, -1);
+        cmd.result->items.push_back(make_item(ITEM_ERROR, ERR_CREATE, share.account_id,
+                                              0, 0, 0));
+        continue;
+      }
+    }
+    else {
+      return -1;
+    }
+    cmds.push_back(cmd);
+  }
+  return 0;
+}
+
+
+
+
+
+
+/*   records of a BIN_TRANSACTIONS message   */
+// returns -1 if a record is not allowed in transactions
+int decode_transactions (const char* rec, long long count, long long account_id,
+                         std::vector<order_command>& cmds,
+                         result_slots* results) {
+  for (long long i = 0; i < count; ++i, rec += BIN_RECORD_SIZE) {
+    int op = (unsigned char)rec[0];
+    order_command cmd;
+    cmd.num = i;
+    cmd.result = add_slot(results);
+    cmd.account_id = account_id;
+    cmd.sym_id = -1;
+    cmd.amount = 0;
+    cmd.price = 0;
+    cmd.order_id = -1;
+
+    if (op == BIN_ORDER) {
+      cmd.type = CHILD_ORDER;
+      cmd.amount = get_le(rec + 8, 8);
+      cmd.price = get_le(rec + 16, 8);
+    }
+    else if (op == BIN_CANCEL || op == BIN_QUERY) {
+      cmd.type = op == BIN_CANCEL ? CHILD_CANCEL : CHILD_QUERY;
+      cmd.order_id = get_le(rec + 8, 8);
+    }
+    else {
+      return -1;
+    }
+
+    int stat = check_order(cmd);
+    if (stat == DECODE_OK && cmd.type == CHILD_ORDER &&
+        !record_symbol(rec, cmd.sym_id, cmd.sym)) {
+      stat = DECODE_SYMBOL;
+    }
+    if (stat == DECODE_OK) {
+      cmds.push_back(cmd);
+    }
+    else if (cmd.type != CHILD_ORDER) { // negative id
+      *cmd.result = make_result(RESULT_ERROR, ERR_NO_ORDER, cmd.order_id);
+    }
+    else {
+      *cmd.result = make_result(RESULT_ORDER_ERROR,
+                                stat == DECODE_AMOUNT ? ERR_AMOUNT :
+                                stat == DECODE_PRICE ? ERR_LIMIT : ERR_ORDER, -1);
+      cmd.result->amount = cmd.amount;
+      cmd.result->price = cmd.price;
+    }
+  }
+  return 0;
+}
+
+
+
+
+
+
+/*   check and execute a binary frame, the response is a binary message   */
+// the same operations as for XML run on the decoded records
+void execute_binary (const char* data, long long len, std::string* response) {
+  try {
+    result_slots results;
+    const char* msg = data + BIN_FRAME_HEAD;
+    long long msg_len = len - BIN_FRAME_HEAD;
+    int stat;
+
+    if (msg_len < BIN_REQUEST_HEAD) {
+      put_status(response, BIN_INVALID);
+      return;
+    }
+    int type = (unsigned char)msg[0];
+    long long count = get_le(msg + 4, 4);
+    long long account_id = get_le(msg + 8, 8);
+    const char* rec = msg + BIN_REQUEST_HEAD;
+    if (count == 0 || msg_len != BIN_REQUEST_HEAD + BIN_RECORD_SIZE * count) {
+      stat = -1;
+    }
+    else if (type == BIN_CREATE) {
+      std::vector <create_command> cmds;
+      stat = decode_create(rec, count, cmds, &results);
+      if (stat == 0) {
+        stat = run_create(cmds);
+      }
+    }
+    else if (type == BIN_TRANSACTIONS) {
+      std::vector <order_command> cmds;
+      stat = account_id < 0 ? -3 :
+             decode_transactions(rec, count, account_id, cmds, &results);
+      if (stat == 0) {
+        stat = run_transactions(account_id, cmds);
+      }
+    }
+    else {
+      stat = -1;
+    }
+
+    if (stat == 0) {
+      render_binary(results, response);
+      return;
+    }
+    int status = stat == -1 ? BIN_INVALID : stat == -2 ? BIN_EXCEPTION : BIN_NO_ACCOUNT;
+    put_status(response, status);
+  }
+  catch (std::exception& e) {
+#if DEBUG
+    std::cerr << "execute_binary: " << e.what() << std::endl;
+#endif
+    put_status(response, BIN_EXCEPTION);
+  }
+  return;
+}
@@ -0,0 +1,67 @@
+#ifndef BINARY_PROTOCOL_H
+#define BINARY_PROTOCOL_H
+
+#include <string>
+#include <vector>
+
+#include "result.h"
+
+/*   fixed-layout little-endian order entry, opted into with BINARY_PREFACE
+
+     frame     uint32 length of the message | uint64 tag | message
+     request   uint8 type | uint8 pad | uint16 reserved | uint32 count |
+               int64 account (BIN_TRANSACTIONS only) | count records
+     record    uint8 op | uint8 pad[7] | int64 a | int64 b | char sym[16]
+                 BIN_ACCOUNT   a = account id, b = balance in ticks
+                 BIN_SHARES    a = account id, b = shares, sym
+                 BIN_ORDER     a = amount (negative to sell), b = limit in ticks, sym
+                 BIN_CANCEL    a = order id
+                 BIN_QUERY     a = order id
+     response  uint8 BIN_RESPONSE | uint8 status | uint16 reserved | uint32 count |
+               count results, each followed by its items
+     result    uint8 kind | uint8 error | uint16 reserved | uint32 items |
+               int64 id | int64 amount | int64 price | int64 time
+     item      same layout as a result, items is 0 and amount holds the shares
+
+   sym is NUL padded, kind and error are the RESULT_*, ITEM_* and ERR_* codes
+   of result.h and there is one result per record, in the order of the records   */
+
+#define BIN_FRAME_HEAD      12      // uint32 length, uint64 tag
+#define BIN_REQUEST_HEAD    16
+#define BIN_RECORD_SIZE     40
+#define BIN_RESPONSE_HEAD   8
+#define BIN_RESULT_SIZE     40
+#define BIN_SYM_SIZE        16
+
+// request types
+#define BIN_CREATE          1
+#define BIN_TRANSACTIONS    2
+#define BIN_RESPONSE        0x81
+
+// record ops
+#define BIN_ACCOUNT         1
+#define BIN_SHARES          2
+#define BIN_ORDER           3
+#define BIN_CANCEL          4
+#define BIN_QUERY           5
+
+// response status
+#define BIN_OK              0
+#define BIN_INVALID         1       // message does not follow the layout
+#define BIN_EXCEPTION       2
+#define BIN_NO_ACCOUNT      3
+#define BIN_BUSY            4
+
+
+
+unsigned long long get_le (const char* p, int size);
+
+void put_le (std::string* out, unsigned long long value, int size);
+
+void render_binary (const result_slots& results, std::string* response);
+
+std::string* binary_status (int status);
+
+void execute_binary (const char* data, long long len, std::string* response);
+
+#endif
@@ -0,0 +1,100 @@
+#include <vector>
+#include <mutex>
+#include <new>
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "buffer_pool.h"
+
+// released slabs of every size class, shared by reactors and workers
+static std::vector <slab*> free_slabs[SLAB_CLASSES];
+static std::mutex free_mtx[SLAB_CLASSES];
+
+
+
+/*   size class of a slab with at least size bytes, -1 if it is too large   */
+int slab_class (long long size) {
+  int shift = SLAB_MIN_SHIFT;
+  while (shift <= SLAB_MAX_SHIFT && (1LL << shift) < size) {
+    ++shift;
+  }
+  return shift <= SLAB_MAX_SHIFT ? shift - SLAB_MIN_SHIFT : -1;
+}
+
+
+
+
+
+
+/*   get a slab with at least size bytes, reused if one is free   */
+slab* slab_get (long long size) {
+  int cls = slab_class(size);
+  long long cap;
+
+  if (cls >= 0) {
+    std::lock_guard<std::mutex> lck (free_mtx[cls]);
+    if (!free_slabs[cls].empty()) {
+      slab* s = free_slabs[cls].back();
+      free_slabs[cls].pop_back();
+      s->len = 0;
+      return s;
+    }
+    cap = 1LL << (cls + SLAB_MIN_SHIFT);
+  }
+  else { // grows in 1 MB chunks beyond the largest class
+    long long chunk = 1LL << SLAB_MAX_SHIFT;
+    cap = (size + chunk - 1) / chunk * chunk;
+  }
+
+  // header and data in one allocation, the data is left uninitialized
+  slab* s = (slab*)malloc(sizeof(slab) + cap);
+  if (s == NULL) {
+    throw std::bad_alloc();
+  }
+  s->data = (char*)(s + 1);
+  s->size = cap;
+  s->len = 0;
+  return s;
+}
+
+
+
+
+
+
+/*   make room for size bytes, the first s->len bytes are kept   */
+slab* slab_grow (slab* s, long long size) {
+  if (s->size >= size) {
+    return s;
+  }
+  slab* bigger = slab_get(size);
+  memcpy(bigger->data, s->data, s->len);
+  bigger->len = s->len;
+  slab_put(s);
+  return bigger;
+}
+
+
+
+
+
+
+/*   hand a slab back to the pool   */
+void slab_put (slab* s) {
+  int cls;
+
+  if (s == NULL) {
+    return;
+  }
+  cls = slab_class(s->size);
+  if (cls >= 0) {
+    std::lock_guard<std::mutex> lck (free_mtx[cls]);
+    if (free_slabs[cls].size() < SLAB_POOL_MAX) {
+      free_slabs[cls].push_back(s);
+      return;
+    }
+  }
+  free(s);
+  return;
+}
@@ -0,0 +1,28 @@
+#ifndef BUFFER_POOL_H
+#define BUFFER_POOL_H
+
+// slabs are kept in power of 2 size classes from 4 KB to 1 MB,
+// larger slabs are returned to the system when released
+#define SLAB_MIN_SHIFT  12
+#define SLAB_MAX_SHIFT  20
+#define SLAB_CLASSES    (SLAB_MAX_SHIFT - SLAB_MIN_SHIFT + 1)
+#define SLAB_POOL_MAX   256     // free slabs kept per size class
+
+
+
+/*   reusable receive buffer, its memory is not zeroed   */
+struct slab {
+  char* data;
+  long long size;             // capacity of data
+  long long len;              // bytes in use
+};
+
+
+
+slab* slab_get (long long size);
+
+slab* slab_grow (slab* s, long long size);
+
+void slab_put (slab* s);
+
+#endif
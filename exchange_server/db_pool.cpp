@@ -0,0 +1,125 @@
+#include <iostream>
+#include <string>
+#include <vector>
+#include <mutex>
+#include <condition_variable>
+
+// database library
+#include <pqxx/pqxx>
+
+#include "db_pool.h"
+
+#define DEBUG           0
+
+// connections shared by every thread which talks to the database
+static std::string pool_conninfo;
+static db_setup_fn pool_setup = NULL;
+static std::vector <pqxx::connection*> idle_conns;
+static int pool_size = 0;
+static int pool_open = 0;     // idle and checked out
+static std::mutex pool_mtx;
+static std::condition_variable pool_cond;
+
+
+
+/*   new connection of the pool, set up for the operations   */
+pqxx::connection* open_conn () {
+  pqxx::connection* conn = new pqxx::connection(pool_conninfo);
+  try {
+    if (pool_setup != NULL) {
+      pool_setup(conn);
+    }
+  }
+  catch (...) {
+    delete conn;
+    throw;
+  }
+  return conn;
+}
+
+
+
+
+
+
+/*   open size connections to the database given by conninfo   */
+// returns -1 if none could be opened, missing ones are retried on demand
+int db_pool_init (const std::string& conninfo, int size, db_setup_fn setup) {
+  std::lock_guard<std::mutex> lck (pool_mtx);
+  pool_conninfo = conninfo;
+  pool_setup = setup;
+  pool_size = size;
+  for (int i = 0; i < size; ++i) {
+    try {
+      idle_conns.push_back(open_conn());
+      ++pool_open;
+    }
+    catch (std::exception& e) {
+      std::cerr << "db_pool_init: " << e.what() << std::endl;
+      break;
+    }
+  }
+  return pool_open > 0 ? 0 : -1;
+}
+
+
+
+
+
+
+/*   take a connection, waits while all of them are in use   */
+// a connection found closed is replaced, throws if the database cannot be
+// reached
+pqxx::connection* db_checkout () {
+  pqxx::connection* conn = NULL;
+  {
+    std::unique_lock<std::mutex> lck (pool_mtx);
+    while (idle_conns.empty() && pool_open >= pool_size) {
+      pool_cond.wait(lck);
+    }
+    if (!idle_conns.empty()) {
+      conn = idle_conns.back();
+      idle_conns.pop_back();
+      if (conn->is_open()) {
+        return conn;
+      }
+      delete conn; // broken while idle, e.g. the server was restarted
+    }
+    else {
+      ++pool_open; // room for one more
+    }
+  }
+
+  // connect outside the lock, it takes a round trip or more
+  try {
+    return open_conn();
+  }
+  catch (std::exception& e) {
+#if DEBUG
+    std::cerr << "db_checkout: " << e.what() << std::endl;
+#endif
+    std::lock_guard<std::mutex> lck (pool_mtx);
+    --pool_open;
+    pool_cond.notify_one();
+    throw;
+  }
+}
+
+
+
+
+
+
+/*   give a connection back, it is closed if it broke while in use   */
+void db_return (pqxx::connection* conn) {
+  std::lock_guard<std::mutex> lck (pool_mtx);
+  if (conn->is_open()) {
+    idle_conns.push_back(conn);
+  }
+  else {
+    delete conn;
+    --pool_open;
+  }
+  pool_cond.notify_one();
+  return;
+}
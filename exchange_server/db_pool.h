@@ -0,0 +1,34 @@
+#ifndef DB_POOL_H
+#define DB_POOL_H
+
+#include <string>
+
+// database library
+#include <pqxx/pqxx>
+
+
+
+// called on every connection the pool opens, before it is handed out
+typedef void (*db_setup_fn) (pqxx::connection* conn);
+
+
+
+int db_pool_init (const std::string& conninfo, int size, db_setup_fn setup);
+
+pqxx::connection* db_checkout ();
+
+void db_return (pqxx::connection* conn);
+
+
+
+/*   connection of the pool held for one unit of work   */
+// given back when it goes out of scope, also when the work throws; declare it
+// before the transaction so that the transaction is closed first
+struct db_lease {
+  pqxx::connection* conn;
+
+  db_lease () : conn(db_checkout()) {}
+  ~db_lease () { db_return(conn); }
+};
+
+#endif
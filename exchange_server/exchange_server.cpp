@@ -6,7 +6,9 @@
 #include <stdlib.h>
 #include <unistd.h>
 #include <string.h>
+#include <errno.h>
 #include <sys/types.h>
+#include <sys/uio.h>
 
 // time calculation libraries
 #include <time.h>
@@ -14,12 +16,16 @@
 
 // network libraries
 #include <sys/socket.h>
+#include <sys/un.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
 #include <netdb.h>
 
 // multi-threading library
 #include <thread>
+#include <chrono>
+#include <pthread.h>
+#include <sched.h>
 
 // boost library for thread pool
 #include <boost/thread/thread.hpp>
@@ -27,27 +33,43 @@
 #include <boost/asio.hpp>
 #include <boost/asio/thread_pool.hpp>
 
-// XML parser libraries
-#ifdef HAVE_CONFIG_H
-#include <config.h>
-#endif
-#include <libxml++/libxml++.h>
-#include <libxml++/parsers/textreader.h>
-
 // database library
 #include <pqxx/pqxx>
 
 #include "operations.h"
+#include "request_parser.h"
+#include "scan_simd.h"
+#include "buffer_pool.h"
+#include "frame_decoder.h"
+#include "response.h"
+#include "binary_protocol.h"
+#include "reactor.h"
+#include "db_pool.h"
+#include "statements.h"
 
 #define DEBUG           0
 #define DOCKER          1
 #define THREAD_POOL     1
+#define REACTOR         1
+#define NUM_REACTOR     1
 #define NUM_THREAD      1
+#define NUM_EXECUTOR    8       // threads executing the children of every request
+#define DB_POOL_SIZE    (NUM_THREAD + NUM_EXECUTOR)     // one per thread which queries
+#define MAX_QUEUE       1024    // requests waiting for or running in the thread pool
+#define STATS_INTERVAL  10      // seconds between two admission reports
 #define NAME_SIZE       128
 #define SERVER_PORT     12345
+#define UNIX_SOCKET     1
+#define UNIX_PATH       "exchange_server.sock"
+
+// exchange_db is the host name used between containers
+#if DOCKER
+#define DB_CONNINFO     "dbname=exchange user=postgres password=psql " \
+                        "host=exchange_db port=5432"
+#else
+#define DB_CONNINFO     "dbname=exchange user=postgres password=psql"
+#endif
 #define MAX_CONN        10240
-#define BUFF_SIZE       409600
-#define RESIZE_SIZE     102400
 #define WAIT_TIME       10
 
 using namespace pqxx;
@@ -75,12 +97,7 @@ long long get_clock_time () {
 int create_table () {
   try {
     // connect to the database
-#if DOCKER
-    connection C("dbname=exchange user=postgres password=psql " \
-                 "host=exchange_db port=5432");
-#else
-    connection C("dbname=exchange user=postgres password=psql");
-#endif
+    connection C(DB_CONNINFO);
     std::string sql;
     result R;
     work W(C);
@@ -145,6 +162,52 @@ int create_table () {
       W.exec(sql);
     }
     
+    // 5. check if table SYMBOL exists
+    sql = "SELECT COUNT(*) FROM " \
+          "information_schema.TABLES WHERE TABLE_NAME='symbol';";
+    R = W.exec(sql);
+    res = R.begin();
+    if (res[0].as<int>() == 0) { // table does not exist, create table
+      sql = "CREATE TABLE SYMBOL(" \
+            "SYM_ID     BIGSERIAL      PRIMARY KEY, " \
+            "SYM        VARCHAR(50)    NOT NULL         UNIQUE);";
+      W.exec(sql);
+    }
+    
+    // 6. check if table POSITION exists
+    sql = "SELECT COUNT(*) FROM " \
+          "information_schema.TABLES WHERE TABLE_NAME='position';";
+    R = W.exec(sql);
+    res = R.begin();
+    if (res[0].as<int>() == 0) { // table does not exist, create table
+      sql = "CREATE TABLE POSITION(" \
+            "ACCOUNT_ID BIGINT         NOT NULL, " \
+            "SYM_ID     BIGINT         NOT NULL, " \
+            "SHARES     BIGINT         NOT NULL         DEFAULT 0 " \
+            "CHECK(SHARES>=0), " \
+            "PRIMARY KEY (ACCOUNT_ID, SYM_ID));";
+      W.exec(sql);
+    }
+    
+    // 7. move shares kept in a column of ACCOUNT per symbol to POSITION
+    sql = "SELECT COLUMN_NAME FROM information_schema.COLUMNS " \
+          "WHERE TABLE_NAME = 'account' " \
+          "AND COLUMN_NAME NOT IN ('account_id', 'balance');";
+    R = W.exec(sql);
+    for (res = R.begin(); res != R.end(); ++res) {
+      std::string sym = res[0].as<std::string>();
+      std::string column = W.quote_name(sym);
+      sql = "INSERT INTO SYMBOL (SYM) VALUES (" + W.quote(sym) + ") " \
+            "ON CONFLICT (SYM) DO NOTHING;";
+      W.exec(sql);
+      sql = "INSERT INTO POSITION (ACCOUNT_ID, SYM_ID, SHARES) " \
+            "SELECT ACCOUNT_ID, SYM_ID, " + column + " FROM ACCOUNT, SYMBOL " \
+            "WHERE SYM = " + W.quote(sym) + " AND " + column + " <> 0;";
+      W.exec(sql);
+      sql = "ALTER TABLE ACCOUNT DROP COLUMN " + column + ";";
+      W.exec(sql);
+    }
+    
     W.commit();
   }
   catch (std::exception& e) {
@@ -161,8 +224,81 @@ int create_table () {
 
 
 
+
+/*   indexes of the order book and of the order history   */
+// created on tables made by an older server as well, after the tables and
+// in a transaction of their own: INCLUDE needs PostgreSQL 11, an older
+// database keeps its tables and the server runs without the indexes.
+// Matching reads one side of a symbol in price-time order, the other
+// columns are included so that it never visits the table
+int create_indexes () {
+  try {
+    connection C(DB_CONNINFO);
+    std::string sql;
+    work W(C);
+
+    sql = "CREATE INDEX IF NOT EXISTS OPENED_BUY_IDX ON OPENED_ORDER " \
+          "(SYM, PRICE DESC, TIME) INCLUDE (ACCOUNT_ID, ORDER_ID, AMOUNT) " \
+          "WHERE AMOUNT > 0;";
+    W.exec(sql);
+    sql = "CREATE INDEX IF NOT EXISTS OPENED_SELL_IDX ON OPENED_ORDER " \
+          "(SYM, PRICE, TIME) INCLUDE (ACCOUNT_ID, ORDER_ID, AMOUNT) " \
+          "WHERE AMOUNT < 0;";
+    W.exec(sql);
+    sql = "CREATE INDEX IF NOT EXISTS CLOSED_ORDER_IDX ON CLOSED_ORDER " \
+          "(ACCOUNT_ID, ORDER_ID) INCLUDE (STATUS, SHARES, PRICE, TIME);";
+    W.exec(sql);
+    W.commit();
+  }
+  catch (std::exception& e) {
+    std::cerr << "indexes not created, orders are matched without them: "
+              << e.what() << std::endl;
+    return -1;
+  }
+  return 0;
+}
+
+
+
+
+
+
+
+/*   fill the symbol catalog with the symbols in SYMBOL   */
+// orders on known symbols then never ask the database for their SYM_ID
+int load_symbols () {
+  try {
+    db_lease lease;
+    work W(*lease.conn);
+    result R = W.exec("SELECT SYM_ID, SYM FROM SYMBOL;");
+    W.commit();
+    for (result::const_iterator res = R.begin(); res != R.end(); ++res) {
+      std::string sym = res[1].as<std::string>();
+      text_view view = { sym.data(), (long long)sym.length() };
+      int sym_id = intern_symbol(view);
+      if (sym_id >= 0) { // the others are looked up when traded
+        catalog_put(sym_id, res[0].as<long long>());
+      }
+    }
+  }
+  catch (std::exception& e) {
+#if DEBUG
+    std::cerr << "load_symbols: " << e.what() << std::endl;
+#endif
+    return -1;
+  }
+  return 0;
+}
+
+
+
+
+
+
 /*   set server socket   */
-int set_socket () {
+// with reuse_port several sockets may listen on SERVER_PORT, the kernel
+// spreads incoming connections among them
+int set_socket (bool reuse_port) {
   int socket_fd;
   int stat;
   char server_hostname[NAME_SIZE];
@@ -194,6 +330,12 @@ int set_socket () {
   int yes = 1;
   stat = setsockopt(socket_fd, SOL_SOCKET, SO_REUSEADDR, (char*)&yes, sizeof(yes)); 
 #endif
+  if (reuse_port) {
+    stat = setsockopt(socket_fd, SOL_SOCKET, SO_REUSEPORT, (char*)&yes, sizeof(yes));
+    if (stat < 0) {
+      perror("Cannot set SO_REUSEPORT");
+    }
+  }
   stat = bind(socket_fd, (struct sockaddr*)&server_addr_info, sizeof(server_addr_info));
   if (stat < 0) {
     perror ("Failed binding");
@@ -211,27 +353,36 @@ int set_socket () {
 
 
 
-/*   check if the receiving has finished using the first line (integer) of XML   */
-int recv_finished (std::vector <char>& buffer, long long received_bytes) {
-  try {
-    std::string xml_len;
-    std::string xml(buffer.data());
-    std::stringstream ss(xml);
-    
-    // integer on the first line is the length of the XML data which follows it
-    ss >> xml_len;
-    if (received_bytes == std::stoll(xml_len) + xml_len.length() + 1) { // plus "\n"
-      // if finished receiving
-      return 1;
-    }
+/*   set unix-domain socket for co-located clients   */
+int set_unix_socket () {
+  int socket_fd;
+  int stat;
+  struct sockaddr_un server_addr_info;
+  
+  memset(&server_addr_info, 0, sizeof(server_addr_info));
+  server_addr_info.sun_family = AF_UNIX;
+  strncpy(server_addr_info.sun_path, UNIX_PATH, sizeof(server_addr_info.sun_path) - 1);
+  unlink(UNIX_PATH); // left behind by the previous run
+  
+  socket_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (socket_fd < 0) {
+    perror("Cannot create unix-domain socket");
+    return -1;
   }
-  catch (std::exception& e) { // wrong XML format
-#if DEBUG
-    std::cerr << "recv_finished: " << e.what() << std::endl;
-#endif
+  stat = bind(socket_fd, (struct sockaddr*)&server_addr_info, sizeof(server_addr_info));
+  if (stat < 0) {
+    perror ("Failed binding unix-domain socket");
+    close(socket_fd);
+    return -1;
+  }
+  stat = listen(socket_fd, MAX_CONN);
+  if (stat < 0) {
+    perror("Failed listening on unix-domain socket");
+    close(socket_fd);
     return -1;
   }
-  return 0; // receiving is not done
+  
+  return socket_fd;
 }
 
 
@@ -240,58 +391,57 @@ int recv_finished (std::vector <char>& buffer, long long received_bytes) {
 
 
 /*   receive XML data of accepted request   */
-int recv_request (int client_conn_sfd, std::vector <char>& buffer) {
+// a client which opened with the binary preface gets binary set and its tag
+int recv_request (int client_conn_sfd, slab** frame, bool* binary, long long* tag) {
   long long len = 0;
-  long long i = 0;
   long long received_bytes = 0;
+  int stat = FRAME_MORE;
+  frame_decoder dec;
   
+  frame_init(dec);
   try {  
-    while (1) {
-      len = recv(client_conn_sfd, &buffer.data()[i], BUFF_SIZE, 0);
-      received_bytes += len;
-      
-      if (recv_finished(buffer, received_bytes) == 1) { // done receiving request
-        break;
-      }
-      else if (recv_finished(buffer, received_bytes) == -1) {
-#if DEBUG
-        std::cerr << "invalid request" << std::endl;
-#endif
-        return -1; // wrong format, exit thread
-      }
-      else { // size isn't enough, resize and continue receiving
-        if (received_bytes == buffer.size()) {
-          buffer.resize(received_bytes + RESIZE_SIZE);
-          i = received_bytes;
+    while (stat == FRAME_MORE) {
+      // receive straight into the frame, the length line is parsed only once
+      long long space;
+      char* data = frame_space(dec, &space);
+      len = recv(client_conn_sfd, data, space, 0);
+      if (len == 0) { // 0 received, connection is closed
+        if (received_bytes != 0) {
+          break;
         }
-        else if (len == 0) { // 0 received, connection is closed
-          if (received_bytes != 0) {
-            break;
-          }
-          else { // no request received, close connection and exit
-            perror("no request");
-            return -1;
-          }
-        }
-        else if (len < 0) { // error
-          perror("request recv");
+        else { // no request received, close connection and exit
+          perror("no request");
+          frame_free(dec);
           return -1;
         }
-        else { // normally should never enter here
+      }
+      else if (len < 0) { // error
+        perror("request recv");
+        frame_free(dec);
+        return -1;
+      }
+      received_bytes += len;
+      stat = frame_commit(dec, len);
+    }
+    if (stat == FRAME_ERROR) {
 #if DEBUG
-          std::cerr << "invalid request" << std::endl;
+      std::cerr << "invalid request" << std::endl;
 #endif
-          return -1;
-        }
-      }
+      frame_free(dec);
+      return -1; // wrong format, exit thread
     }
+    *binary = dec.preface == PREFACE_BINARY;
+    *tag = frame_tagged(dec) ? dec.tag : NO_TAG;
+    *frame = frame_take(dec);
   }
   catch (std::exception& e) {
 #if DEBUG
     std::cerr << "recv_request: " << e.what() << std::endl;
 #endif
+    frame_free(dec);
     return -1;
   }
+  frame_free(dec);
   return received_bytes;
 }
 
@@ -300,65 +450,49 @@ int recv_request (int client_conn_sfd, std::vector <char>& buffer) {
 
 
 
-/*   remove first two lines and all "\n"   */
-int parse_xml_simple (std::string& xml) {
-  try {
-    std::stringstream ss;
-    std::size_t pos;
-    std::string line;
-    
-    if ((pos = xml.find("\n")) != std::string::npos) {
-      // ignore the first line (integer)
-      xml = xml.substr(pos+1);
-    }
-    else {
-      return -1; // invalid format
-    }
-  
-    if ((pos = xml.find("<create>\n")) != std::string::npos) {
-      ss << xml.substr(pos);
-      xml = xml.substr(pos+9); // remove <create>
-      if ((pos = xml.find("<transactions")) != std::string::npos) {
-        return -1; // cannot have both create and transactions
-      }
-      if ((pos = xml.find("<create>\n")) != std::string::npos) {
-        return -1; // cannot have more than one <create>
-      }
-    }
-    else if ((pos = xml.find("<transactions")) != std::string::npos) {
-      ss << xml.substr(pos);
-      std::stringstream temp_ss(xml.substr(pos));
-      std::string temp;
-      std::getline(temp_ss, temp, '\n');
-      std::getline(temp_ss, temp, '\n');
-      pos = xml.find(temp);
-      xml = xml.substr(pos);
-      if ((pos = xml.find("<transactions")) != std::string::npos) {
-        return -1; // cannot have more than one <transactions>
-      }
+/*   <results> of a request, stat is what handle_create/handle_transactions returned   */
+// when sink has sent part of the results already, only the rest is rendered;
+// -4 is a streamed request found malformed after some children were executed
+void render_results (int stat, const result_slots& results, const result_sink* sink,
+                     std::string* response) {
+  std::size_t sent = sink != NULL ? sink->sent : 0;
+
+  if (sent != 0 || stat == -4) { // results which were executed, then the error
+    if (sent == 0) {
+      *response = "<results>\n";
     }
-    
-    if (xml.find("<account") == std::string::npos &&
-        xml.find("<symbol") == std::string::npos &&
-        xml.find("<order") == std::string::npos &&
-        xml.find("<cancel") == std::string::npos &&
-        xml.find("<query") == std::string::npos) {
-      return -1; // no child
+    render_xml(results, sent, results.size(), response);
+    if (stat == -1 || stat == -4) { // malformed after children were executed
+      response->append("  <error>Invalid XML request</error>\n");
     }
-    
-    xml = "";
-    // remove all "\n" for parsing purpose
-    while (getline(ss, line, '\n')) {
-      xml += line;
+    else if (stat != 0) {
+      response->append("  <error>unexpected exception</error>\n");
     }
+    response->append("</results>\n");
   }
-  catch (std::exception& e) {
-#if DEBUG
-    std::cerr << "parse_xml_simple: " << e.what() << std::endl;
-#endif
-    return -1;
+  else if (stat == -1) { // invalid XML request
+    *response = "<results>\n" \
+                "  <error>Invalid XML request</error>\n" \
+                "</results>\n";
   }
-  return 0;
+  else if (stat == -2) { // unexpected exception caught
+    *response = "<results>\n" \
+                "  <error>unexpected exception</error>\n" \
+                "</results>\n";
+  }
+  else if (stat == -3) { // account of <transactions> does not exist
+    *response = "<results>\n" \
+                "  <error>account does not exist</error>\n" \
+                "</results>\n";
+  }
+  else {
+    response->reserve(sizeof("<results>\n</results>\n") +
+                      xml_size(results, 0, results.size()));
+    *response = "<results>\n";
+    render_xml(results, 0, results.size(), response);
+    response->append("</results>\n");
+  }
+  return;
 }
 
 
@@ -367,76 +501,32 @@ int parse_xml_simple (std::string& xml) {
 
 
 /*   parse and execute the operation of request   */
-void execute_request (std::vector <char>& buffer, std::string* response) {
+// with a sink the results of a <transactions> are sent as they are done,
+// response is the rest
+void execute_request (const char* data, long long len, std::string* response,
+                      result_sink* sink) {
+  result_slots results;
   try {
-    std::string id;
-    std::string balance;
-    std::string sym;
-    std::string shares;
-    std::string xml(buffer.data());
+    parsed_request req;
     int stat;
     
-    if (parse_xml_simple(xml) < 0) {
-      *response += "<results>\n" \
-                   "  <error>Invalid XML request</error>\n" \
-                   "</results>\n";
-      return;
+    // the whole request is checked before any operation runs
+    if (parse_request(data, len, req) < 0) {
+      stat = -1;
     }
-    xmlpp::TextReader reader((const unsigned char*)xml.c_str(), xml.length());
-    reader.read();
-    // create, account, symbol or NUM of shares (<account id=\"12\">60</account>)
-    if (reader.get_name() == "create") { // handle <create>
-      stat = handle_create(reader, response);
-      if (stat == -1) { // invalid XML request
-        *response += "<results>\n" \
-                    "  <error>Invalid XML request</error>\n" \
-                    "</results>\n";
-      }
-      else if (stat == -2) { // unexpected exception caught
-        *response += "<results>\n" \
-                     "  <error>unexpected exception</error>\n" \
-                     "</results>\n";
-      }
-      else { /*   TODO   */
-        *response = "<results>\n" + *response;
-        response->append("</results>\n");
-      }
+    else if (req.root == ROOT_CREATE) { // handle <create>
+      stat = handle_create(req, &results);
     }
-    else if (reader.get_name() == "transactions") { // handle <transactions>
-      stat = handle_transactions(reader, response);
-      if (stat == -1) {
-        *response = "<results>\n" \
-                    "  <error>Invalid XML request</error>\n" \
-                    "</results>\n";
-      }
-      else if (stat == -2) { // unexpected exception caught
-        *response = "<results>\n" \
-                    "  <error>unexpected exception</error>\n" \
-                    "</results>\n";
-      }
-      else if (stat == -3) { // unexpected exception caught
-        *response = "<results>\n" \
-                    "  <error>account does not exist</error>\n" \
-                    "</results>\n";
-      }
-      else {
-        *response = "<results>\n" + *response;
-        response->append("</results>\n");
-      }
-    }
-    else { // invalid request
-      *response += "<results>\n" \
-                   "  <error>Invalid XML request</error>\n" \
-                   "</results>\n";
+    else { // handle <transactions>
+      stat = handle_transactions(req, &results, sink);
     }
+    render_results(stat, results, sink, response);
   }
   catch (std::exception& e) {
 #if DEBUG
     std::cerr << "execute_request: " << e.what() << std::endl;
 #endif
-    *response += "<results>\n" \
-                 "  <error>Invalid XML request</error>\n" \
-                 "</results>\n";
+    render_results(-1, results, sink, response);
   }
   return;
 }
@@ -447,30 +537,52 @@ void execute_request (std::vector <char>& buffer, std::string* response) {
 
 
 /*   handle accepted request   */
-void handle_request (int request_id, int client_conn_sfd, std::string* response) {
+void handle_request (int request_id, int client_conn_sfd, std::string* response,
+                     admission* adm) {
   long long start_time = get_clock_time();
   long long end_time;
   try {
-    std::vector <char> buffer(BUFF_SIZE);
+    slab* frame = NULL;
     int received_bytes;
     int stat;
+    bool binary = false;
+    long long tag = NO_TAG;
     
     std::cout << "request_id: " << request_id << ", client_conn_sfd: "
               << client_conn_sfd << "\n" << std::endl;
     
-    received_bytes = recv_request(client_conn_sfd, buffer);
+    received_bytes = recv_request(client_conn_sfd, &frame, &binary, &tag);
     if (received_bytes <= 0) { // invalid XML request
       *response = "<result>\n  <error>Invalid XML request</error>\n</result>\n";
     }
+    else if (binary) {
+      execute_binary(frame->data, frame->len, response);
+      slab_put(frame);
+    }
     else {
       // parse and execute request
-      execute_request(buffer, response);
+      execute_request(frame->data, frame->len, response, NULL);
+      slab_put(frame);
     }
-    *response = std::to_string(response->length()) + "\n" + 
-                   "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n" + *response;
+    char head[RESPONSE_HEAD_SIZE];
+    int head_len = response_head(*response, tag, binary, head);
         
-    // send resulting XML response
-    int len = send(client_conn_sfd, response->data(), response->length(), 0);
+    // send resulting XML response, continue after a short write
+    struct iovec iov[RESPONSE_IOV];
+    std::size_t sent = 0;
+    int n;
+    int parts = binary ? 0 : SEND_PROLOG;
+    while ((n = response_iov(head, head_len, *response, sent, parts, iov)) > 0) {
+      ssize_t len = writev(client_conn_sfd, iov, n);
+      if (len < 0) {
+        if (errno == EINTR) {
+          continue;
+        }
+        perror("response send");
+        break;
+      }
+      sent += len;
+    }
     close(client_conn_sfd);
   }
   catch (std::exception& e) {
@@ -481,6 +593,55 @@ void handle_request (int request_id, int client_conn_sfd, std::string* response)
   end_time = get_clock_time();
   std::cout << "execution time of the task: " << end_time - start_time << std::endl;
   delete response;
+  finish_request(*adm);
+  return;
+}
+
+
+
+
+
+
+/*   pin calling thread to one cpu core   */
+void pin_thread (int core) {
+  int num_cores = std::thread::hardware_concurrency();
+  cpu_set_t cpuset;
+  
+  if (num_cores <= 0) {
+    return;
+  }
+  CPU_ZERO(&cpuset);
+  CPU_SET(core % num_cores, &cpuset);
+  if (pthread_setaffinity_np(pthread_self(), sizeof(cpuset), &cpuset) != 0) {
+    perror("Cannot set cpu affinity");
+  }
+  return;
+}
+
+
+
+
+
+
+/*   print the admission queue depth and counters periodically   */
+void report_stats (admission* adm) {
+  while (1) {
+    std::this_thread::sleep_for(std::chrono::seconds(STATS_INTERVAL));
+    std::cout << "admission queue depth: " << adm->depth.load()
+              << ", admitted: " << adm->admitted.load()
+              << ", rejected: " << adm->rejected.load() << std::endl;
+  }
+}
+
+
+
+
+
+
+/*   event loop of one reactor thread   */
+void run_reactor (reactor* r, int core) {
+  pin_thread(core);
+  reactor_run(*r);
   return;
 }
 
@@ -491,15 +652,65 @@ void handle_request (int request_id, int client_conn_sfd, std::string* response)
 
 /*   MAIN   */
 int main () {
-  int server_sfd = set_socket(); 
+#if REACTOR
+  int server_sfd = set_socket(NUM_REACTOR > 1);
+#else
+  int server_sfd = set_socket(false);
+#endif
   int thread_id = 0;
   
   if (create_table() < 0) { // failed to create table
     return EXIT_FAILURE;
   }
+  create_indexes(); // the server is only slower without them
+  // connections are opened once and shared by every request, each with the
+  // statements of the operations prepared
+  if (db_pool_init(DB_CONNINFO, DB_POOL_SIZE, prepare_statements) < 0) {
+    return EXIT_FAILURE;
+  }
+  if (load_symbols() < 0) {
+    return EXIT_FAILURE;
+  }
+  std::cout << "request scanning: " << scan_kernel() << std::endl;
   
-  // thread pool with maximum NUM_THREAD concurrently running threads
+  // thread pool with maximum NUM_THREAD concurrently running threads,
+  // at most MAX_QUEUE requests are admitted to it at a time
   boost::asio::thread_pool handler(NUM_THREAD);
+  // the children of the requests run here, no thread is started per request
+  boost::asio::thread_pool executor(NUM_EXECUTOR);
+  set_executor(&executor);
+  admission adm;
+  admission_init(adm, MAX_QUEUE);
+  std::thread(report_stats, &adm).detach();
+#if REACTOR
+  // epoll event loops own every client socket, only complete requests
+  // are posted to the thread pool. Each reactor has its own SO_REUSEPORT
+  // listening socket and runs on its own core. The first one also
+  // serves the unix-domain socket.
+#if UNIX_SOCKET
+  int unix_sfd = set_unix_socket();
+#else
+  int unix_sfd = -1;
+#endif
+  std::vector <reactor*> reactors;
+  std::vector <std::thread> reactor_threads;
+  for (int i = 0; i < NUM_REACTOR; ++i) {
+    int listen_sfd = (i == 0) ? server_sfd : set_socket(true);
+    reactor* r = new reactor;
+    if (listen_sfd < 0 ||
+        reactor_init(*r, listen_sfd, (i == 0) ? unix_sfd : -1, &handler, &adm) < 0) {
+      return EXIT_FAILURE;
+    }
+    reactors.push_back(r);
+  }
+  for (int i = 1; i < NUM_REACTOR; ++i) {
+    reactor_threads.push_back(std::thread(run_reactor, reactors[i], i));
+  }
+  run_reactor(reactors[0], 0);
+  for (std::size_t i = 0; i < reactor_threads.size(); ++i) {
+    reactor_threads[i].join();
+  }
+#else
   while (1) {
     try {
       struct sockaddr_in client_addr;
@@ -512,13 +723,17 @@ int main () {
         perror("Cannot accept connection");
         continue;
       }
+      if (!admit_request(adm)) { // queue is full, refuse the connection
+        close(client_conn_sfd);
+        continue;
+      }
       
       std::string* response = new std::string;
 #if THREAD_POOL
-      boost::asio::post(handler, boost::bind(handle_request,
-                                             thread_id, client_conn_sfd, response));
+      boost::asio::post(handler, boost::bind(handle_request, thread_id,
+                                             client_conn_sfd, response, &adm));
 #else
-      handle_request(thread_id, client_conn_sfd, response);
+      handle_request(thread_id, client_conn_sfd, response, &adm);
 #endif
       ++thread_id;
       if (thread_id >= MAX_CONN*16) {
@@ -531,7 +746,9 @@ int main () {
 #endif
     }
   }
+#endif
   handler.join();
+  executor.join();
   close (server_sfd);
   return EXIT_SUCCESS;
 }
@@ -0,0 +1,278 @@
+#include <string.h>
+
+#include "buffer_pool.h"
+#include "frame_decoder.h"
+#include "binary_protocol.h"
+
+#define RECV_SIZE       4096
+#define MAX_LEN_DIGITS  18
+
+// decoder states
+#define STATE_START     0
+#define STATE_PREFACE   1
+#define STATE_HEADER    2
+#define STATE_BODY      3
+#define STATE_DONE      4
+#define STATE_ERROR     5
+#define STATE_TAG       6
+
+// indexed by PREFACE_*
+static const char* const prefaces[] = { "", PERSISTENT_PREFACE, SHM_RING_PREFACE,
+                                         PIPELINED_PREFACE, BINARY_PREFACE,
+                                         CHUNKED_PREFACE };
+
+
+
+/*   reset decoder to the beginning of a connection   */
+void frame_init (frame_decoder& d) {
+  d.state = STATE_START;
+  d.buf = NULL;
+  d.len = 0;
+  d.scanned = 0;
+  d.header_len = 0;
+  d.body_len = 0;
+  d.tag_start = 0;
+  d.tag = 0;
+  d.preface = PREFACE_NONE;
+  d.persistent = false;
+  return;
+}
+
+
+
+
+
+
+/*   release the frame buffer   */
+void frame_free (frame_decoder& d) {
+  slab_put(d.buf);
+  d.buf = NULL;
+  return;
+}
+
+
+
+
+
+
+/*   examine the bytes received since the last call   */
+// every byte of the length line is looked at exactly once
+void frame_scan (frame_decoder& d) {
+  if (d.buf == NULL) {
+    return; // nothing received yet
+  }
+  char* data = d.buf->data;
+
+  while (d.scanned < d.len) {
+    char c = data[d.scanned];
+    if (d.state == STATE_START) {
+      if (c >= '0' && c <= '9') {
+        d.state = STATE_HEADER;
+        continue;
+      }
+      d.state = STATE_PREFACE;
+    }
+    else if (d.state == STATE_PREFACE) {
+      // PREFACE_NONE is "", which a '\0' would match without ever ending
+      if (d.preface == PREFACE_NONE || c != prefaces[d.preface][d.scanned]) {
+        // switch to a preface which also matches what has been seen so far
+        d.preface = PREFACE_NONE;
+        for (int i = PREFACE_PERSISTENT; i < PREFACE_COUNT; ++i) {
+          if (strncmp(prefaces[i], data, d.scanned) == 0 &&
+              prefaces[i][d.scanned] == c) {
+            d.preface = i;
+            break;
+          }
+        }
+        if (d.preface == PREFACE_NONE) {
+          d.state = STATE_ERROR;
+          return;
+        }
+      }
+      const char* preface = prefaces[d.preface];
+      long long preface_len = strlen(preface);
+      if (++d.scanned == preface_len) { // drop the preface, frames follow
+        memmove(data, data + preface_len, d.len - preface_len);
+        d.len -= preface_len;
+        d.scanned = 0;
+        d.persistent = true;
+        d.state = STATE_HEADER;
+      }
+    }
+    else if (d.state == STATE_HEADER && d.preface == PREFACE_BINARY) {
+      if (d.len < BIN_FRAME_HEAD) { // length and tag are read at once
+        d.scanned = d.len;
+        break;
+      }
+      d.body_len = get_le(data, 4);
+      d.tag = get_le(data + 4, 8);
+      d.header_len = BIN_FRAME_HEAD;
+      d.scanned = d.len;
+      d.state = STATE_BODY;
+    }
+    else if (d.state == STATE_HEADER) {
+      if (c >= '0' && c <= '9' && d.scanned < MAX_LEN_DIGITS) {
+        d.body_len = d.body_len * 10 + (c - '0');
+        ++d.scanned;
+      }
+      else if (c == ' ' && d.scanned != 0 && d.preface == PREFACE_PIPELINED) {
+        d.tag_start = ++d.scanned;
+        d.state = STATE_TAG;
+      }
+      else if (c == '\n' && d.scanned != 0 && d.preface != PREFACE_PIPELINED) {
+        d.header_len = d.scanned + 1; // length line complete
+        d.scanned = d.len; // the body is not examined
+        d.state = STATE_BODY;
+      }
+      else { // not a decimal length
+        d.state = STATE_ERROR;
+        return;
+      }
+    }
+    else if (d.state == STATE_TAG) {
+      if (c >= '0' && c <= '9' && d.scanned - d.tag_start < MAX_LEN_DIGITS) {
+        d.tag = d.tag * 10 + (c - '0');
+        ++d.scanned;
+      }
+      else if (c == '\n' && d.scanned != d.tag_start) {
+        d.header_len = d.scanned + 1; // "<len> <tag>" line complete
+        d.scanned = d.len;
+        d.state = STATE_BODY;
+      }
+      else { // not a decimal tag
+        d.state = STATE_ERROR;
+        return;
+      }
+    }
+    else {
+      break;
+    }
+  }
+  if (d.state == STATE_BODY && d.len >= d.header_len + d.body_len) {
+    d.state = STATE_DONE;
+  }
+  return;
+}
+
+
+
+
+
+
+/*   where the next recv() should write and how many bytes it may write   */
+// buffers come from the slab pool and are not zeroed
+char* frame_space (frame_decoder& d, long long* space) {
+  long long want;
+
+  if (d.buf == NULL) {
+    d.buf = slab_get(RECV_SIZE + 1);
+  }
+  d.buf->len = d.len; // kept when the slab grows
+  if (d.state == STATE_BODY) { // read exactly up to the end of this frame
+    long long total = d.header_len + d.body_len;
+    if (d.buf->size < total + 1 && d.buf->size - 1 - d.len < RECV_SIZE) {
+      // grow by size classes instead of trusting the announced length up front
+      long long new_size = d.buf->size * 2 > d.len + RECV_SIZE + 1 ?
+                           d.buf->size * 2 : d.len + RECV_SIZE + 1;
+      d.buf = slab_grow(d.buf, new_size < total + 1 ? new_size : total + 1);
+    }
+    want = d.buf->size - 1 - d.len;
+    if (want > total - d.len) {
+      want = total - d.len;
+    }
+  }
+  else {
+    if (d.buf->size < d.len + RECV_SIZE + 1) {
+      d.buf = slab_grow(d.buf, d.len + RECV_SIZE + 1);
+    }
+    want = RECV_SIZE;
+  }
+  *space = want;
+  return d.buf->data + d.len;
+}
+
+
+
+
+
+
+/*   account for n bytes written at frame_space()   */
+int frame_commit (frame_decoder& d, long long n) {
+  d.len += n;
+  frame_scan(d);
+  return frame_status(d);
+}
+
+
+
+
+
+
+/*   FRAME_DONE if a complete frame can be taken   */
+int frame_status (frame_decoder& d) {
+  if (d.state == STATE_DONE) {
+    return FRAME_DONE;
+  }
+  if (d.state == STATE_ERROR) {
+    return FRAME_ERROR;
+  }
+  return FRAME_MORE;
+}
+
+
+
+
+
+
+/*   hand out the complete frame ("<len>\n<xml>", NUL terminated)   */
+// if the frame is not complete, whatever has been received is handed out;
+// bytes following the frame start the next one
+slab* frame_take (frame_decoder& d) {
+  slab* frame = d.buf != NULL ? d.buf : slab_get(1);
+  long long size = d.state == STATE_DONE ? d.header_len + d.body_len : d.len;
+  long long left = d.len - size;
+
+  d.buf = NULL;
+  if (left > 0) { // at most one recv() worth of bytes
+    d.buf = slab_get(left + RECV_SIZE + 1);
+    memcpy(d.buf->data, frame->data + size, left);
+  }
+  frame->len = size;
+  frame->data[size] = '\0';
+
+  d.state = STATE_HEADER; // the preface may only appear once
+  d.len = left;
+  d.scanned = 0;
+  d.header_len = 0;
+  d.body_len = 0;
+  d.tag_start = 0;
+  d.tag = 0;
+  frame_scan(d);
+  return frame;
+}
+
+
+
+
+
+
+/*   XML received so far of a frame whose length line is complete   */
+// NULL before that and once the frame is complete; the pointer is only
+// valid until the next frame_space()
+const char* frame_body (frame_decoder& d, long long* len) {
+  if (d.state != STATE_BODY) {
+    return NULL;
+  }
+  *len = d.len - d.header_len;
+  return d.buf->data + d.header_len;
+}
+
+
+
+
+
+
+/*   whether frames carry a correlation tag and may be answered out of order   */
+bool frame_tagged (frame_decoder& d) {
+  return d.preface == PREFACE_PIPELINED || d.preface == PREFACE_BINARY;
+}
@@ -0,0 +1,63 @@
+#ifndef FRAME_DECODER_H
+#define FRAME_DECODER_H
+
+#include "buffer_pool.h"
+
+// results of frame_commit
+#define FRAME_ERROR     -1
+#define FRAME_MORE      0
+#define FRAME_DONE      1
+
+// optional first line of a connection
+#define PREFACE_NONE        0
+#define PREFACE_PERSISTENT  1
+#define PREFACE_SHM_RING    2
+#define PREFACE_PIPELINED   3
+#define PREFACE_BINARY      4
+#define PREFACE_CHUNKED     5
+#define PREFACE_COUNT       6
+#define PERSISTENT_PREFACE  "persistent\n"
+#define SHM_RING_PREFACE    "shm-ring\n"
+#define PIPELINED_PREFACE   "pipelined\n"
+#define BINARY_PREFACE      "\x7f" "EXB1"
+#define CHUNKED_PREFACE     "chunked\n"
+
+
+
+/*   incremental decoder of a "[<preface>]<len>\n<xml><len>\n<xml>..." stream   */
+// after the pipelined preface every length line is "<len> <tag>\n", after the
+// binary one every frame starts with a 12 byte length and tag (binary_protocol.h)
+// bytes are received straight into the frame buffer, the length line is
+// parsed once as it arrives and a complete frame is handed out without copying
+struct frame_decoder {
+  int state;
+  slab* buf;                  // frame being assembled, NULL until bytes arrive
+  long long len;              // bytes received into buf
+  long long scanned;          // bytes of buf already examined by the decoder
+  long long header_len;       // length of "<len>\n", known in the body state
+  long long body_len;         // XML length announced by the length line
+  long long tag_start;        // offset of the correlation tag in the length line
+  long long tag;              // correlation tag of a pipelined frame
+  int preface;                // PREFACE_* the stream started with
+  bool persistent;            // more than one request may follow
+};
+
+
+
+void frame_init (frame_decoder& d);
+
+void frame_free (frame_decoder& d);
+
+char* frame_space (frame_decoder& d, long long* space);
+
+int frame_commit (frame_decoder& d, long long n);
+
+int frame_status (frame_decoder& d);
+
+slab* frame_take (frame_decoder& d);
+
+const char* frame_body (frame_decoder& d, long long* len);
+
+bool frame_tagged (frame_decoder& d);
+
+#endif
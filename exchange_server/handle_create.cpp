@@ -4,93 +4,55 @@
 #include <sstream>
 #include <memory>
 
-#ifdef HAVE_CONFIG_H
-#include <config.h>
-#endif
-#include <libxml++/libxml++.h>
-#include <libxml++/parsers/textreader.h>
-
-// boost library for thread pool
-#include <boost/thread/thread.hpp>
-#include <boost/bind.hpp>
-#include <boost/asio.hpp>
-#include <boost/asio/thread_pool.hpp>
-
 // database library
 #include <pqxx/pqxx>
 
+#include "request_parser.h"
+#include "order_command.h"
+#include "result.h"
+#include "db_pool.h"
+#include "statements.h"
+
 #define DEBUG           0
-#define DOCKER          1
-#define THREAD_POOL     1
-#define NUM_THREAD      1
 
 using namespace pqxx;
 
 
 
 /*   add new account to the database   */
-void create_account (std::string id, std::string balance, std::string* response) {
+void create_account (account_command cmd, op_result* slot) {
   try {
-    std::string sql;
     result R;
     result::const_iterator res;
-    // connect to the database
-    // exchange_db is the host name used between containers
-#if DOCKER
-    connection C("dbname=exchange user=postgres password=psql " \
-                 "host=exchange_db port=5432");
-#else
-    connection C("dbname=exchange user=postgres password=psql ");
-#endif
-    work W(C);
+    // take a connection of the pool
+    db_lease lease;
+    work W(*lease.conn);
     
-    try {
-      if (std::stoll(id) < 0) { // invalid account number
-        *response += "  <error id=\"" + id + "\">Invalid account number</error>\n";
-        return;
-      }
-      else if (std::stold(balance) < 0) { // invalid balance value
-        *response += "  <error id=\"" + id + "\">Invalid balance value</error>\n";
-        return;
-      }
-    }
-    catch (std::exception& e) { // invalid account or balance format
-      *response += "  <error id=\"" + id + "\">Invalid account or balance</error>\n";
-      return;
-    }
     // check if the account already exists
-    sql = "SELECT COUNT(ACCOUNT_ID) FROM ACCOUNT WHERE ACCOUNT_ID = "
-          + W.quote(id) + ";";
-    R = W.exec(sql);
+    R = W.prepared(STMT_ACCOUNT_COUNT)(cmd.account_id).exec();
     res = R.begin();
     if (res[0].as<int>() != 0) { // account already exists, response <error>
-      *response += "  <error id=\"" + id + "\">Account already exists</error>\n";
+      *slot = make_result(RESULT_ERROR, ERR_ACCOUNT_EXISTS, cmd.account_id);
       return;
     }
     
     // account does not exist, create new account
-    sql = "INSERT INTO ACCOUNT (ACCOUNT_ID, BALANCE) VALUES (";
-    sql += W.quote(id) + ", ";
-    sql += W.quote(balance) + ");";
-    W.exec(sql);
+    W.prepared(STMT_INSERT_ACCOUNT)(cmd.account_id)(format_price(cmd.balance)).exec();
     
     // create record in ORDER_NUM
-    sql = "INSERT INTO ORDER_NUM (ACCOUNT_ID, NUM) VALUES (" +
-          W.quote(id) + ", 0);";
-    W.exec(sql);
+    W.prepared(STMT_INSERT_ORDER_NUM)(cmd.account_id).exec();
     
     W.commit();
-    C.disconnect();
   }
   catch (std::exception& e) {
 #if DEBUG
     std::cerr << "create_account: " << e.what() << std::endl;
 #endif
-    *response = "  <error id=\"" + id + "\">" + "Invalid request...</error>\n";
+    *slot = make_result(RESULT_ERROR, ERR_CREATE, cmd.account_id);
     return;
   }
   // successfully created, response <created>
-  *response += "  <created id=\"" + id + "\"/>\n";
+  *slot = make_result(RESULT_CREATED, ERR_NONE, cmd.account_id);
   return;
 }
 
@@ -99,103 +61,91 @@ void create_account (std::string id, std::string balance, std::string* response)
 
 
 
+/*   whether one of the accounts shares are given to exists   */
+bool any_account (pqxx::connection* conn, const std::vector<share_command>& share_arr) {
+  work W(*conn);
+  for (std::size_t i = 0; i < share_arr.size(); ++i) {
+    if (!W.prepared(STMT_ACCOUNT_ID)(share_arr[i].account_id).exec().empty()) {
+      return true;
+    }
+  }
+  return false;
+}
+
+
+
+
+
+
 /*   add symbol shares to specific account(s)   */
-void add_shares (std::string sym, std::vector<std::string> id_arr,
-                std::vector<std::string> num_shares_arr, std::string* response) {
+// sym_id is -1 for a symbol which is not in the market yet, sym is its text
+void add_shares (int sym_id, const std::string& sym, std::vector<share_command> share_arr,
+                 op_result* slot) {
+  op_result symbol = make_result(RESULT_SYMBOL, ERR_NONE, -1);
+  symbol.sym_id = sym_id;
+  if (sym_id < 0) {
+    symbol.sym = sym;
+  }
   try {
-    std::string sql;
     result R;
-    // connect to the database
-    // exchange_db is the host name used between containers
-#if DOCKER
-    connection C("dbname=exchange user=postgres password=psql " \
-                 "host=exchange_db port=5432");
-#else
-    connection C("dbname=exchange user=postgres password=psql ");
-#endif
-    work W(C);
-
-    // check if the column indicated by sym exists
-    sql = "SELECT COLUMN_NAME FROM information_schema.COLUMNS "\
-          "WHERE TABLE_NAME = 'account';";
-    R = W.exec(sql);
-    bool column_exist = false;
-    for (result::const_iterator res = R.begin(); res != R.end(); ++res) {
-      for (result::tuple::const_iterator field = res->begin();
-           field != res->end(); ++field) {
-        if (field->c_str() == sym) {
-          column_exist = true;
-          break; // column exists, break;
-        }
-      }
-    }
-    if (column_exist == false) { // column indicated by sym does not exist
-      // add new column, shares of a symbol should not be negative
-      sql = "ALTER TABLE ACCOUNT ADD COLUMN \"" + sym +
-            "\" BIGINT NOT NULL DEFAULT 0 CHECK(\"" + sym + "\">=0);";
-      W.exec(sql);
+    // take a connection of the pool
+    db_lease lease;
+    // a new symbol is one row of SYMBOL, only added when one of the accounts
+    // exists, shares for nobody leave no symbol behind
+    long long sym_key = NO_SYMBOL_KEY;
+    if (sym_id >= 0 || any_account(lease.conn, share_arr)) {
+      sym_key = symbol_key(lease.conn, symbol.sym_id, sym);
     }
+    work W(*lease.conn);
     
-    std::string temp_response;
-    for (std::size_t i = 0; i < id_arr.size(); ++i) {
+    for (std::size_t i = 0; i < share_arr.size(); ++i) {
       // check if the account exists
-      sql = "SELECT ACCOUNT_ID FROM ACCOUNT WHERE ACCOUNT_ID = " +
-            W.quote(id_arr[i]);
-      R = W.exec(sql);
+      R = W.prepared(STMT_ACCOUNT_ID)(share_arr[i].account_id).exec();
       result::const_iterator res = R.begin();
       if (res == R.end()) { // account does not exist
         //W.commit();
-        temp_response += "    <error id=\"" + id_arr[i] +
-                         "\">Account does not exist</error>\n";
+        symbol.items.push_back(make_item(ITEM_ERROR, ERR_NO_ACCOUNT,
+                                      share_arr[i].account_id, 0, 0, 0));
+        continue;
+      }
+      if (sym_key == NO_SYMBOL_KEY) { // account created since it was looked for
+        symbol.items.push_back(make_item(ITEM_ERROR, ERR_CREATE,
+                                      share_arr[i].account_id, 0, 0, 0));
         continue;
       }
       
       // add new symbol shares, should be non-negative
       long long updated_shares;
       // get current shares first
-      sql = "SELECT \"" + sym + "\" FROM ACCOUNT WHERE ACCOUNT_ID = " +
-            W.quote(id_arr[i]) + ";";
-      R = W.exec(sql);
-      res = R.begin();
-      long long curr_shares = res[0].as<long long>();
+      long long curr_shares = position_shares(W, share_arr[i].account_id, sym_key);
       // check if net shares is negative
-      updated_shares = curr_shares + std::stoll(num_shares_arr[i]);
-      if (updated_shares < 0) { // negative value
-        temp_response += "    <error id=\"" + id_arr[i] +
-                         "\">Negative share value</error>\n";
+      if (__builtin_add_overflow(curr_shares, share_arr[i].shares, &updated_shares) ||
+          updated_shares < 0) { // negative value
+        symbol.items.push_back(make_item(ITEM_ERROR, ERR_NEGATIVE_SHARES,
+                                      share_arr[i].account_id, 0, 0, 0));
         continue;
       }
       
       // update shares of sym
-      sql = "UPDATE ACCOUNT SET \"" + sym + "\" = " +
-            std::to_string(updated_shares) + " WHERE ACCOUNT_ID = " +
-            W.quote(id_arr[i]) + ";";
-      W.exec(sql);
-      temp_response += "    <created id=\"" + id_arr[i] + "\"/>\n";
-    }
-    // generate response XML
-    if (temp_response.find("<error") == std::string::npos) { // if no <error>
-      *response = *response + "  <created sym=\"" + sym + "\">\n" +
-                 temp_response + "  </created>\n";
-    }
-    else { // if there is <error>, use <error sym="XX">
-      *response = *response + "  <error sym=\"" + sym + "\">\n" +
-                 temp_response + "  </error>\n";
+      W.prepared(STMT_UPDATE_SHARES)(share_arr[i].account_id)(sym_key)
+                (updated_shares).exec();
+      symbol.items.push_back(make_item(ITEM_CREATED, ERR_NONE, share_arr[i].account_id,
+                                    share_arr[i].shares, 0, 0));
     }
     W.commit();
-    C.disconnect();
   }
-  catch (std::exception& e) { // exception caught, generate response XML
+  catch (std::exception& e) { // exception caught, none of the accounts got shares
 #if DEBUG
     std::cerr << "add_shares: " << e.what() << std::endl;
 #endif
-    *response = "  <error sym=\"" + sym + "\">\n";
-    for (std::size_t i = 0; i < id_arr.size(); ++i) {
-      *response += "    <error id=\"" + id_arr[i] + "\">" +
-                   "Invalid request...</error>\n";
+    symbol.items.clear();
+    for (std::size_t i = 0; i < share_arr.size(); ++i) {
+      symbol.items.push_back(make_item(ITEM_ERROR, ERR_CREATE,
+                                    share_arr[i].account_id, 0, 0, 0));
     }
-    *response += "  </error>\n";
   }
+  // <created sym=""> or <error sym=""> if one of the accounts failed
+  *slot = symbol;
   return;
 }
 
@@ -204,124 +154,24 @@ void add_shares (std::string sym, std::vector<std::string> id_arr,
 
 
 
-/*   if root node of XML is <create>   */
-int handle_create (xmlpp::TextReader& reader, std::string* response) {
+/*   execute the decoded children of a <create>   */
+// one after another on the thread of the request: a <symbol> may give shares
+// to an account created by an earlier child, so they cannot run side by side
+int run_create (const std::vector<create_command>& cmds) {
   try {
-    std::string id;
-    std::string balance;
-    std::string sym;
-    bool create_open = false;
-    boost::asio::thread_pool handler(NUM_THREAD);
-    
-    do {
-      if (reader.get_name() == "create") {
-        if (create_open == true) {
-          break; // encounter </create>, finish
-        }
-        create_open = true;
-      }
-      else if (reader.get_name() == "account") { // if node's name is "account"
-        if (reader.get_attribute_count() == 2) { // if node has 2 attribute
-          reader.move_to_first_attribute();
-          if (reader.get_name() == "id") { // 1st attribute should be "id"
-            id = reader.get_value();
-          }
-          else {
-            return -1; // invalid XML request
-          }
-          
-          reader.move_to_next_attribute();
-          if (reader.get_name() == "balance") { // 2nd attribute should be "balance"
-            balance = reader.get_value();
-          }
-          else {
-            return -1; // invalid XML request
-          }
-#if THREAD_POOL
-          boost::asio::post(handler, boost::bind(create_account,
-                                                 id, balance, response));
-#else
-          create_account(id, balance, response); // create account
-#endif
-        }
-        else { // not 2 attributes, invalid XML request
-          return -1;
-        }
-      }
-      
-      
-      /*   <symbol sym="SPY">                <--- starts here
-             <account id="123">100</account>
-             <account id="456">200</account>
-           </symbol>   */
-      else if (reader.get_name() == "symbol") { // if node's name is "symbol"
-        if (reader.get_attribute_count() == 1) { // if node has 1 attribute (sym)
-          reader.move_to_first_attribute();
-          if (reader.get_name() == "sym") { // 1st attribute should be "sym"
-            sym = reader.get_value();
-          }
-          else {
-            return -1; // invalid XML request
-          }
-          
-          std::vector <std::string> id_arr;
-          std::vector <std::string> num_shares_arr;
-          while (1) { // get all <account id="xxx">NUM</account>
-            reader.read();
-            if (reader.get_name() == "symbol") { // encounter </symbol>, finish
-              break;
-            }
-            else if (reader.get_name() == "account") {
-              if (reader.get_attribute_count() == 1) { // can only have attribute "id"
-                reader.move_to_first_attribute();
-                id_arr.push_back(reader.get_value()); // add id
-              }
-              else {
-                return -1; // invalid XML request
-              }
-              reader.read();
-              if (reader.get_name() == "#text") { // NUM of shares field
-                num_shares_arr.push_back(reader.get_value()); // add NUM of shares
-                reader.read(); // read one more time to skip </account>
-                if (reader.get_name() != "account") {
-                  return -1; // invalid XML request
-                }
-              }
-              else {
-                return -1; // invalid XML request
-              }
-            }
-            else if (reader.get_name() == "#text") {
-              continue; // ignore spaces
-            }
-            else {
-              return -1; // invalid XML request
-            }
-          }
-#if THREAD_POOL
-          boost::asio::post(handler, boost::bind(add_shares,
-                                                 sym, id_arr,
-                                                 num_shares_arr, response));
-#else
-          add_shares(sym, id_arr, num_shares_arr, response);
-#endif
-        }
-        else {
-          return -1; // invalid XML request
-        }
+    for (std::size_t i = 0; i < cmds.size(); ++i) {
+      const create_command& cmd = cmds[i];
+      if (cmd.type == CHILD_ACCOUNT) { // <account id="" balance=""/>
+        create_account(cmd.account, cmd.result);
       }
-      else if (reader.get_name() == "#text") {
-        continue; // ignore spaces
+      else { // <symbol sym=""><account id="">NUM</account>...</symbol>
+        add_shares(cmd.sym_id, cmd.sym, cmd.shares, cmd.result);
       }
-      else {
-        return -1; // invalid XML request
-      }
-    } while (reader.read());
-    handler.join();
+    }
   }
   catch (std::exception& e) {
 #if DEBUG
-    std::cerr << "handle_create: " << e.what() << std::endl;
+    std::cerr << "run_create: " << e.what() << std::endl;
 #endif
     return -2; // unexpected exception
   }
@@ -330,3 +180,72 @@ int handle_create (xmlpp::TextReader& reader, std::string* response) {
 
 
 
+
+
+
+/*   if root node of XML is <create>   */
+int handle_create (const parsed_request& req, result_slots* results) {
+  std::vector <create_command> cmds;
+  
+  for (std::size_t i = 0; i < req.children.size(); ++i) {
+    const child_record& child = req.children[i];
+    create_command cmd;
+    op_result* slot = add_slot(results);
+    cmd.type = child.type;
+    cmd.result = slot;
+    
+    if (child.type == CHILD_ACCOUNT) { // <account id="" balance=""/>
+      int stat = decode_account(child, cmd.account);
+      if (stat == DECODE_OK) {
+        cmds.push_back(cmd);
+        continue;
+      }
+      APPEND_LITERAL(&slot->text, "  <error id=\"");
+      slot->text.append(child.attr[0].ptr, child.attr[0].len);
+      if (stat == DECODE_ID) { // invalid account number
+        APPEND_LITERAL(&slot->text, "\">Invalid account number</error>\n");
+      }
+      else if (stat == DECODE_PRICE) { // invalid balance value
+        APPEND_LITERAL(&slot->text, "\">Invalid balance value</error>\n");
+      }
+      else { // invalid account or balance format
+        APPEND_LITERAL(&slot->text, "\">Invalid account or balance</error>\n");
+      }
+    }
+    
+    
+    /*   <symbol sym="SPY">                <--- starts here
+           <account id="123">100</account>
+           <account id="456">200</account>
+         </symbol>   */
+    else if (child.type == CHILD_SYMBOL) {
+      bool valid = true;
+      decode_symbol(child.attr[0], cmd.sym_id, cmd.sym);
+      cmd.shares.resize(child.num_shares);
+      for (long long j = 0; j < child.num_shares; ++j) {
+        if (decode_share(req.shares[child.first_share + j], cmd.shares[j]) != DECODE_OK) {
+          valid = false;
+        }
+      }
+      if (valid) {
+        cmds.push_back(cmd);
+        continue;
+      }
+      // none of the shares is added if one of them is malformed
+      APPEND_LITERAL(&slot->text, "  <error sym=\"");
+      slot->text.append(child.attr[0].ptr, child.attr[0].len);
+      APPEND_LITERAL(&slot->text, "\">\n");
+      for (long long j = 0; j < child.num_shares; ++j) {
+        const text_view& id = req.shares[child.first_share + j].id;
+        APPEND_LITERAL(&slot->text, "    <error id=\"");
+        slot->text.append(id.ptr, id.len);
+        APPEND_LITERAL(&slot->text, "\">Invalid request...</error>\n");
+      }
+      APPEND_LITERAL(&slot->text, "  </error>\n");
+    }
+    else {
+      return -1; // invalid XML request
+    }
+  }
+  return run_create(cmds);
+}
@@ -9,18 +9,13 @@
 
 #include <time.h>
 
-#ifdef HAVE_CONFIG_H
-#include <config.h>
-#endif
-#include <libxml++/libxml++.h>
-#include <libxml++/parsers/textreader.h>
-
 // boost library for thread pool
 #include <boost/thread/thread.hpp>
 #include <boost/bind.hpp>
 #include <boost/asio.hpp>
 #include <boost/asio/thread_pool.hpp>
 #include <mutex>
+#include <condition_variable>
 
 // pthread for cpu affinity
 #define _GNU_SOURCE
@@ -29,26 +24,50 @@
 // database library
 #include <pqxx/pqxx>
 
+#include "request_parser.h"
+#include "order_command.h"
+#include "result.h"
+#include "db_pool.h"
+#include "statements.h"
+
 #define DEBUG		0
-#define DOCKER          1
-#define THREAD_POOL     1
-#define NUM_THREAD      8
 #define BEST_PRICE      1
 #define SELL            0
 #define BUY             1
 
+// state of the account of a batch
+#define ACCOUNT_CHECKING  0
+#define ACCOUNT_FOUND     1
+#define ACCOUNT_MISSING   2
+#define ACCOUNT_FAILED    3
+
 using namespace pqxx;
 
-std::mutex mtx;
+// shared by the children of every request, see set_executor
+boost::asio::thread_pool* executor = NULL;
+
 
 
+/*   children of one <transactions>, executed while more are being added   */
+struct transactions_batch {
+  long long account_id;
+  result_slots* results;      // NULL when the commands come with their slots
+  result_sink* sink;          // NULL when the response is sent as a whole
+  std::mutex batch_mtx;
+  std::condition_variable idle;   // running has dropped to 0
+  long long running;          // account check and children posted, not finished
+  int account;                // ACCOUNT_*, children run once it is ACCOUNT_FOUND
+  std::vector <order_command> pending;  // added while the account is checked
+  std::vector <char> done;    // per slot, whether its child is done
+};
 
-/*   function to control format of data which will be stored to the database  */
-std::string set_precision (long double ld) {
-  std::string str = std::to_string(ld);
-  std::size_t pos = str.find(".");
-  str = str.substr(0, pos+3);
-  return str;
+
+
+/*   hand the result of a child to its slot of the request   */
+// the slot is only written by the thread executing the child, no lock needed
+void add_result (const order_command& cmd, const op_result& res) {
+  *cmd.result = res;
+  return;
 }
 
 
@@ -56,36 +75,50 @@ std::string set_precision (long double ld) {
 
 
 
+/*   result of an <order>, it repeats sym, amount and limit of the order   */
+void add_order_result (const order_command& cmd, int kind, int error,
+                       long long order_id) {
+  op_result res = make_result(kind, error, order_id);
+  res.sym_id = cmd.sym_id;
+  if (cmd.sym_id < 0) { // a symbol which is not in the market
+    res.sym = cmd.sym;
+  }
+  res.amount = cmd.amount;
+  res.price = cmd.price;
+  add_result(cmd, res);
+  return;
+}
+
+
+
 /*   update transaction records including balance, amount and finished orders   */
-int update_record (work& W, int status, std::string& sym,
-                   std::string& seller_account_id, std::string& buyer_account_id,
-                   long long& matched_amount_ld, long double& matched_limit_ld) {
+// matched_limit_ld is in ticks, sym_key is the SYM_ID of sym
+int update_record (work& W, int status, const std::string& sym, long long sym_key,
+                   long long seller_account_id, long long buyer_account_id,
+                   long long matched_amount_ld, long long matched_limit_ld) {
   try {
-    std::string sql;
     result R;
     result::const_iterator res;
-    std::string seller_order_id;
-    std::string buyer_order_id;
-    long double seller_curr_balance_ld;
-    long double seller_new_balance_ld;
+    long long seller_order_id;
+    long long buyer_order_id;
+    long long seller_curr_balance_ld;
+    long long seller_new_balance_ld;
     long long seller_curr_shares_ld;
     long long seller_new_shares_ld;
     long long seller_curr_amount_ld;
     long long seller_new_amount_ld;
-    long double buyer_curr_balance_ld;
-    long double buyer_new_balance_ld;
+    long long buyer_curr_balance_ld;
+    long long buyer_new_balance_ld;
     long long buyer_curr_shares_ld;
     long long buyer_new_shares_ld;
     long long buyer_curr_amount_ld;
     long long buyer_new_amount_ld;
-    long double balance_diff_ld;
+    long long balance_diff_ld;
     long long amount_diff_ld;
     
     /*   1. update seller and buyer's accounts (ACCOUNT)  */
     // get seller's current balance and sym shares
-    sql = "SELECT BALANCE, \"" + sym + "\" FROM ACCOUNT WHERE ACCOUNT_ID = " +
-          W.quote(seller_account_id) + ";";
-    R = W.exec(sql);
+    R = W.prepared(STMT_BALANCE_SHARES)(seller_account_id)(sym_key).exec();
     /*   TODO: pay attention to possible segfault   */
     res = R.begin();
     if (res == R.end()) {
@@ -93,13 +126,11 @@ int update_record (work& W, int status, std::string& sym,
       std::cerr << "6" << std::endl;
 #endif
     }
-    seller_curr_balance_ld = res[0].as<long double>();
+    seller_curr_balance_ld = price_ticks(res[0].as<std::string>());
     seller_curr_shares_ld = res[1].as<long long>();
     
     // get buyer's current balance and sym shares
-    sql = "SELECT BALANCE, \"" + sym + "\" FROM ACCOUNT WHERE ACCOUNT_ID = " +
-          W.quote(buyer_account_id) + ";";
-    R = W.exec(sql);
+    R = W.prepared(STMT_BALANCE_SHARES)(buyer_account_id)(sym_key).exec();
     /*   TODO: pay attention to possible segfault   */
     res = R.begin();
     if (res == R.end()) {
@@ -107,11 +138,13 @@ int update_record (work& W, int status, std::string& sym,
       std::cerr << "7" << std::endl;
 #endif
     }
-    buyer_curr_balance_ld = res[0].as<long double>();
+    buyer_curr_balance_ld = price_ticks(res[0].as<std::string>());
     buyer_curr_shares_ld = res[1].as<long long>();
     
     // calculate seller and buyer's new account balance
-    balance_diff_ld = matched_amount_ld * matched_limit_ld;
+    if (__builtin_mul_overflow(matched_amount_ld, matched_limit_ld, &balance_diff_ld)) {
+      return -1;
+    }
     seller_new_balance_ld = seller_curr_balance_ld + balance_diff_ld;
     seller_new_shares_ld = seller_curr_shares_ld - matched_amount_ld;
     buyer_new_balance_ld = buyer_curr_balance_ld - balance_diff_ld;
@@ -119,17 +152,13 @@ int update_record (work& W, int status, std::string& sym,
     
     if (status == SELL) {
       // update buyer's account
-      sql = "UPDATE ACCOUNT SET \"" + sym + "\" = " +
-            W.quote(std::to_string(buyer_new_shares_ld)) +
-            " WHERE ACCOUNT_ID = " + W.quote(buyer_account_id) + ";";
-      W.exec(sql);
+      W.prepared(STMT_UPDATE_SHARES)(buyer_account_id)(sym_key)
+                (buyer_new_shares_ld).exec();
     }
     else { // status == BUY
       // update seller's account
-      sql = "UPDATE ACCOUNT SET BALANCE = " +
-            W.quote(set_precision(seller_new_balance_ld)) +
-            " WHERE ACCOUNT_ID = " + W.quote(seller_account_id) + ";";
-      W.exec(sql);
+      W.prepared(STMT_UPDATE_BALANCE)(seller_account_id)
+                (format_price(seller_new_balance_ld)).exec();
     }
     
     
@@ -138,81 +167,59 @@ int update_record (work& W, int status, std::string& sym,
     // get seller's current amount
     if (status == SELL) {
       // get buyer's current amount
-      sql = "SELECT ORDER_ID, AMOUNT FROM OPENED_ORDER WHERE ACCOUNT_ID = " +
-            W.quote(buyer_account_id) + " AND SYM = " + W.quote(sym) +
-            " AND PRICE = " + W.quote(set_precision(matched_limit_ld)) +
-            " ORDER BY TIME ASC;";
-      R = W.exec(sql);
+      R = W.prepared(STMT_BUYER_ORDER)(buyer_account_id)(sym)
+                    (format_price(matched_limit_ld)).exec();
       /*   TODO: pay attention to possible segfault   */
       res = R.begin();
       if (res == R.end()) {
 #if DEBUG
-        std::cerr << "8: " + sql << std::endl;
+        std::cerr << "8" << std::endl;
 #endif
       }
-      buyer_order_id = res[0].as<std::string>();
+      buyer_order_id = res[0].as<long long>();
       buyer_curr_amount_ld = res[1].as<long long>();
       buyer_new_amount_ld = buyer_curr_amount_ld - matched_amount_ld;
       // update buyer's opened order
       /*   TODO: newly added   */
       if (buyer_new_amount_ld == 0) {
-        sql = "DELETE FROM OPENED_ORDER WHERE ACCOUNT_ID = " +
-              W.quote(buyer_account_id) +
-              " AND ORDER_ID = " + W.quote(buyer_order_id) + ";";
+        W.prepared(STMT_DELETE_OPENED)(buyer_account_id)(buyer_order_id).exec();
       }
       else {
-        sql = "UPDATE OPENED_ORDER SET AMOUNT =" +
-              W.quote(std::to_string(buyer_new_amount_ld)) +
-              " WHERE ACCOUNT_ID = " + W.quote(buyer_account_id) +
-              " AND ORDER_ID = " + W.quote(buyer_order_id) + ";";
+        W.prepared(STMT_UPDATE_OPENED)(buyer_account_id)(buyer_order_id)
+                  (buyer_new_amount_ld).exec();
       }
     }
     else { // status == BUY
       // get seller's current amount
-      sql = "SELECT ORDER_ID, AMOUNT FROM OPENED_ORDER WHERE ACCOUNT_ID = " +
-            W.quote(seller_account_id) + " AND SYM = " + W.quote(sym) +
-            " AND AMOUNT < 0 AND PRICE <= " + W.quote(set_precision(matched_limit_ld)) +
-            " ORDER BY PRICE ASC, TIME ASC;";
-      R = W.exec(sql);
+      R = W.prepared(STMT_SELLER_ORDER)(seller_account_id)(sym)
+                    (format_price(matched_limit_ld)).exec();
       /*   TODO: pay attention to possible segfault   */
       res = R.begin();
       if (res == R.end()) {
 #if DEBUG
-        std::cerr << "9: " + sql << std::endl;
+        std::cerr << "9" << std::endl;
 #endif
       }
-      seller_order_id = res[0].as<std::string>();
+      seller_order_id = res[0].as<long long>();
       seller_curr_amount_ld = res[1].as<long long>();
       // seller's amount should be negative to indicate "sell"
       seller_new_amount_ld = -(-seller_curr_amount_ld - matched_amount_ld);
       // update seller's opened order
       if (seller_new_amount_ld == 0) {
-        sql = "DELETE FROM OPENED_ORDER WHERE ACCOUNT_ID = " +
-              W.quote(seller_account_id) +
-              " AND ORDER_ID = " + W.quote(seller_order_id) + ";";
+        W.prepared(STMT_DELETE_OPENED)(seller_account_id)(seller_order_id).exec();
       }
       else {
-        sql = "UPDATE OPENED_ORDER SET AMOUNT =" +
-              W.quote(std::to_string(seller_new_amount_ld)) +
-              " WHERE ACCOUNT_ID = " + W.quote(seller_account_id) +
-              " AND ORDER_ID = " + W.quote(seller_order_id) + ";";
+        W.prepared(STMT_UPDATE_OPENED)(seller_account_id)(seller_order_id)
+                  (seller_new_amount_ld).exec();
       }
     }
-    W.exec(sql);
     
     
     
     /*   3. update record of finished orders (CLOSED_ORDER)   */
     if (status == SELL) {
       // get current number of orders for seller
-#if 0
-      sql = "SELECT COUNT(*) FROM OPENED_ORDER WHERE ACCOUNT_ID = " +
-            W.quote(seller_account_id) + ";";
-#else
-      sql = "SELECT NUM FROM ORDER_NUM WHERE ACCOUNT_ID = " +
-            W.quote(seller_account_id) + ";";
-#endif
-      R = W.exec(sql);
+      R = W.prepared(STMT_SELECT_ORDER_NUM)(seller_account_id).exec();
       res = R.begin();
 #if 1
       if (res == R.end()) { // no record
@@ -222,21 +229,14 @@ int update_record (work& W, int status, std::string& sym,
       // seller order id is his current number of opened orders plus 1
       /*   TODO: ATT   */
 #if 0
-      seller_order_id = std::to_string(res[0].as<long long>()+1);
+      seller_order_id = res[0].as<long long>()+1;
 #else
-      seller_order_id = std::to_string(res[0].as<long long>());
+      seller_order_id = res[0].as<long long>();
 #endif
     }
     else { // status == BUY
       // get current number of orders for buyer
-#if 0
-      sql = "SELECT COUNT(*) FROM OPENED_ORDER WHERE ACCOUNT_ID = " +
-            W.quote(buyer_account_id) + ";";
-#else
-      sql = "SELECT NUM FROM ORDER_NUM WHERE ACCOUNT_ID = " +
-            W.quote(buyer_account_id) + ";";
-#endif
-      R = W.exec(sql);
+      R = W.prepared(STMT_SELECT_ORDER_NUM)(buyer_account_id).exec();
       res = R.begin();
 #if 1
       if (res == R.end()) { // no record
@@ -246,32 +246,20 @@ int update_record (work& W, int status, std::string& sym,
       // buyer order id is his current number of opened orders plus 1
       /*   TODO: ATT   */
 #if 0
-      buyer_order_id = std::to_string(res[0].as<long long>()+1);
+      buyer_order_id = res[0].as<long long>()+1;
 #else
-      buyer_order_id = std::to_string(res[0].as<long long>());
+      buyer_order_id = res[0].as<long long>();
 #endif
     }
     // update seller and buyer's finished order records
+    // status 0 indicate it is executed (1 is canceled)
+    std::string matched_limit = format_price(matched_limit_ld);
     time_t curr_time = time(NULL);
-    sql = "INSERT INTO CLOSED_ORDER ";
-    sql += "(ACCOUNT_ID, ORDER_ID, STATUS, SHARES, PRICE, TIME) VALUES (" +
-           W.quote(seller_account_id) + ", " +
-           W.quote(seller_order_id) + ", " +
-           "0, " + // 0 indicate it is executed (1 is canceled)
-           W.quote(std::to_string(-matched_amount_ld)) + ", " +
-           W.quote(set_precision(matched_limit_ld)) + ", " +
-           W.quote(std::to_string(curr_time)) + ");";
-    W.exec(sql);
+    W.prepared(STMT_INSERT_CLOSED)(seller_account_id)(seller_order_id)(0)
+              (-matched_amount_ld)(matched_limit)(curr_time).exec();
     curr_time = time(NULL);
-    sql = "INSERT INTO CLOSED_ORDER ";
-    sql += "(ACCOUNT_ID, ORDER_ID, STATUS, SHARES, PRICE, TIME) VALUES (" +
-           W.quote(buyer_account_id) + ", " +
-           W.quote(buyer_order_id) + ", " +
-           "0, " + // 0 indicate it is executed (1 is canceled)
-           W.quote(std::to_string(matched_amount_ld)) + ", " +
-           W.quote(set_precision(matched_limit_ld)) + ", " +
-           W.quote(std::to_string(curr_time)) + ");";
-    W.exec(sql);
+    W.prepared(STMT_INSERT_CLOSED)(buyer_account_id)(buyer_order_id)(0)
+              (matched_amount_ld)(matched_limit)(curr_time).exec();
   }
   catch (std::exception& e) {
 #if DEBUG
@@ -289,51 +277,39 @@ int update_record (work& W, int status, std::string& sym,
 
 /*   match order   */
 // NOTE: reference to return_order_id in declaration should not be modified
-int match_order (work& W, std::string& return_order_id,
-                 std::string& account_id, std::string& sym,
-                 std::string& amount, std::string& limit,
-                 std::string* response) {
+int match_order (work& W, long long& return_order_id,
+                 const order_command& cmd, long long sym_key) {
   // find matching from database
   try {
-    std::string sql;
     result R;
     result::const_iterator res;
-    long long amount_ld = std::stoll(amount);
-    long double limit_ld = std::stold(limit);
+    const std::string& sym = cmd.sym_id >= 0 ? symbol_name(cmd.sym_id) : cmd.sym;
+    std::string limit = format_price(cmd.price);
+    long long amount_ld = cmd.amount;
+    long long limit_ld = cmd.price;
     long long buyer_amount_ld;
-    long double buyer_limit_ld;
+    long long buyer_limit_ld;
     long long seller_amount_ld;
-    long double seller_limit_ld;
+    long long seller_limit_ld;
     long long matched_amount_ld;
-    long double matched_limit_ld;
-    std::string buyer_account_id;
-    std::string seller_account_id;
-    std::string order_id;
+    long long matched_limit_ld;
+    long long buyer_account_id;
+    long long seller_account_id;
+    long long order_id;
     
     /*   sell goods, find buyers   */
     if (amount_ld < 0) {
-      seller_account_id = account_id;
+      seller_account_id = cmd.account_id;
       seller_amount_ld = -amount_ld;
       seller_limit_ld = limit_ld;
       
-      sql = "SELECT * FROM OPENED_ORDER WHERE SYM = " + W.quote(sym) +
-            " AND ACCOUNT_ID != " + W.quote(seller_account_id) +
-            " AND AMOUNT > 0 AND PRICE >= " + W.quote(limit) +
-            " ORDER BY PRICE DESC, TIME ASC;";
-      R = W.exec(sql);
+      R = W.prepared(STMT_MATCH_BUYERS)(sym)(seller_account_id)(limit).exec();
       res = R.begin();
       
       // if there is no match
       if (res == R.end()) {
         // get current number of orders for seller
-#if 0
-        sql = "SELECT COUNT(*) FROM OPENED_ORDER WHERE ACCOUNT_ID = " +
-              W.quote(seller_account_id) + ";";
-#else
-        sql = "SELECT NUM FROM ORDER_NUM WHERE ACCOUNT_ID = " +
-              W.quote(seller_account_id) + ";";
-#endif
-        R = W.exec(sql);
+        R = W.prepared(STMT_SELECT_ORDER_NUM)(seller_account_id).exec();
         res = R.begin();
 #if 1
         if (res == R.end()) { // no record, add one
@@ -342,25 +318,16 @@ int match_order (work& W, std::string& return_order_id,
 #endif
         // seller order id is his current number of opened orders plus 1
         /*   TODO: ATT   */
-        order_id = std::to_string(res[0].as<long long>()+1);
+        order_id = res[0].as<long long>()+1;
         return_order_id = order_id;
         
         time_t curr_time = time(NULL);
         // store order into database for future match
-        sql = "INSERT INTO OPENED_ORDER ";
-        sql += "(ACCOUNT_ID, ORDER_ID, SYM, AMOUNT, PRICE, TIME) VALUES (";
-        sql += W.quote(seller_account_id) + ", ";
-        sql += W.quote(order_id) + ", ";
-        sql += W.quote(sym) + ", ";
-        sql += W.quote(std::to_string(-seller_amount_ld)) + ", ";
-        sql += W.quote(limit) + ", ";
-        sql += W.quote(std::to_string(curr_time)) + ");";
-        W.exec(sql);
+        W.prepared(STMT_INSERT_OPENED)(seller_account_id)(order_id)(sym)
+                  (-seller_amount_ld)(limit)(curr_time).exec();
         
 #if 1
-        sql = "UPDATE ORDER_NUM SET NUM = " +  W.quote(order_id) +
-              " WHERE ACCOUNT_ID = " + W.quote(seller_account_id) + ";";
-        W.exec(sql);
+        W.prepared(STMT_UPDATE_ORDER_NUM)(seller_account_id)(order_id).exec();
 #endif
         
         return 0;
@@ -368,12 +335,12 @@ int match_order (work& W, std::string& return_order_id,
       
       // if there is a match
       for (res = R.begin(); res != R.end(); ++res) {
-        buyer_account_id = res[0].as<std::string>();
+        buyer_account_id = res[0].as<long long>();
         matched_amount_ld = res[3].as<long long>();
-        matched_limit_ld = res[4].as<long double>();
+        matched_limit_ld = price_ticks(res[4].as<std::string>());
         if (seller_amount_ld > matched_amount_ld) {
           seller_amount_ld -= matched_amount_ld;
-          if (update_record(W, SELL, sym, seller_account_id, buyer_account_id,
+          if (update_record(W, SELL, sym, sym_key, seller_account_id, buyer_account_id,
                             matched_amount_ld, matched_limit_ld) < 0) {
             return -1;
           }
@@ -381,7 +348,7 @@ int match_order (work& W, std::string& return_order_id,
         else { // goods all sold
           matched_amount_ld = seller_amount_ld;
           seller_amount_ld = 0; // seller's good sold out
-          if (update_record(W, SELL, sym, seller_account_id, buyer_account_id,
+          if (update_record(W, SELL, sym, sym_key, seller_account_id, buyer_account_id,
                             matched_amount_ld, matched_limit_ld) < 0) {
             return -1;
           }
@@ -396,14 +363,7 @@ int match_order (work& W, std::string& return_order_id,
       if (1) {
 #endif
         // get current number of orders for seller
-#if 0
-        sql = "SELECT COUNT(*) FROM OPENED_ORDER WHERE ACCOUNT_ID = " +
-              W.quote(seller_account_id) + ";";
-#else
-        sql = "SELECT NUM FROM ORDER_NUM WHERE ACCOUNT_ID = " +
-              W.quote(seller_account_id) + ";";
-#endif
-        R = W.exec(sql);
+        R = W.prepared(STMT_SELECT_ORDER_NUM)(seller_account_id).exec();
         res = R.begin();
 #if 1
         if (res == R.end()) { // no record
@@ -413,24 +373,15 @@ int match_order (work& W, std::string& return_order_id,
 
         // seller order id is his current number of opened orders plus 1
         /*   TODO: ATT   */
-        order_id = std::to_string(res[0].as<long long>()+1);
+        order_id = res[0].as<long long>()+1;
         return_order_id = order_id;
         
         time_t curr_time = time(NULL);
         // store order into database for future match
-        sql = "INSERT INTO OPENED_ORDER ";
-        sql += "(ACCOUNT_ID, ORDER_ID, SYM, AMOUNT, PRICE, TIME) VALUES (";
-        sql += W.quote(seller_account_id) + ", ";
-        sql += W.quote(order_id) + ", ";
-        sql += W.quote(sym) + ", ";
-        sql += W.quote(std::to_string(-seller_amount_ld)) + ", ";
-        sql += W.quote(limit) + ", ";
-        sql += W.quote(std::to_string(curr_time)) + ");";
-        W.exec(sql);
+        W.prepared(STMT_INSERT_OPENED)(seller_account_id)(order_id)(sym)
+                  (-seller_amount_ld)(limit)(curr_time).exec();
 #if 1
-        sql = "UPDATE ORDER_NUM SET NUM = " +  W.quote(order_id) +
-              " WHERE ACCOUNT_ID = " + W.quote(seller_account_id) + ";";
-        W.exec(sql);
+        W.prepared(STMT_UPDATE_ORDER_NUM)(seller_account_id)(order_id).exec();
 #endif
       }
     }
@@ -439,28 +390,17 @@ int match_order (work& W, std::string& return_order_id,
     
     /*   purchase goods, find sellers   */
     else {
-      buyer_account_id = account_id;
+      buyer_account_id = cmd.account_id;
       buyer_amount_ld = amount_ld;
       buyer_limit_ld = limit_ld;
       
-      sql = "SELECT * FROM OPENED_ORDER WHERE SYM = " + W.quote(sym) +
-            " AND ACCOUNT_ID != " + W.quote(buyer_account_id) +
-            " AND AMOUNT < 0 AND PRICE <= " + W.quote(limit) +
-            " ORDER BY PRICE ASC, TIME ASC;";
-      R = W.exec(sql);
+      R = W.prepared(STMT_MATCH_SELLERS)(sym)(buyer_account_id)(limit).exec();
       res = R.begin();
       
       // if there is no match
       if (res == R.end()) {
         // get current number of orders for seller
-#if 0
-        sql = "SELECT COUNT(*) FROM OPENED_ORDER WHERE ACCOUNT_ID = " +
-              W.quote(buyer_account_id) + ";";
-#else
-        sql = "SELECT NUM FROM ORDER_NUM WHERE ACCOUNT_ID = " +
-              W.quote(buyer_account_id) + ";";
-#endif
-        R = W.exec(sql);
+        R = W.prepared(STMT_SELECT_ORDER_NUM)(buyer_account_id).exec();
         res = R.begin();
 #if 1
         if (res == R.end()) { // no record
@@ -469,25 +409,16 @@ int match_order (work& W, std::string& return_order_id,
 #endif
         // seller order id is his current number of opened orders plus 1
         /*   TODO: ATT   */
-        order_id = std::to_string(res[0].as<long long>()+1);
+        order_id = res[0].as<long long>()+1;
         return_order_id = order_id;
         
         time_t curr_time = time(NULL);
         // store order into database for future match
-        sql = "INSERT INTO OPENED_ORDER ";
-        sql += "(ACCOUNT_ID, ORDER_ID, SYM, AMOUNT, PRICE, TIME) VALUES (";
-        sql += W.quote(buyer_account_id) + ", ";
-        sql += W.quote(order_id) + ", ";
-        sql += W.quote(sym) + ", ";
-        sql += W.quote(std::to_string(buyer_amount_ld)) + ", ";
-        sql += W.quote(limit) + ", ";
-        sql += W.quote(std::to_string(curr_time)) + ");";
-        W.exec(sql);
+        W.prepared(STMT_INSERT_OPENED)(buyer_account_id)(order_id)(sym)
+                  (buyer_amount_ld)(limit)(curr_time).exec();
 #if 1
         // update NUM in ORDER_NUM
-        sql = "UPDATE ORDER_NUM SET NUM = " + W.quote(order_id) +
-              " WHERE ACCOUNT_ID = " + W.quote(buyer_account_id) + ";";
-        W.exec(sql);
+        W.prepared(STMT_UPDATE_ORDER_NUM)(buyer_account_id)(order_id).exec();
 #endif
         
         return 0;
@@ -495,17 +426,17 @@ int match_order (work& W, std::string& return_order_id,
       
       // if there is a match
       for (res = R.begin(); res != R.end(); ++res) {
-        seller_account_id = res[0].as<std::string>();
+        seller_account_id = res[0].as<long long>();
         matched_amount_ld = -res[3].as<long long>();
 #if BEST_PRICE
-        matched_limit_ld = res[4].as<long double>();
+        matched_limit_ld = price_ticks(res[4].as<std::string>());
 #else
-        matched_limit_ld = std::stold(limit);
+        matched_limit_ld = limit_ld;
 #endif
         
         if (buyer_amount_ld > matched_amount_ld) {
           buyer_amount_ld -= matched_amount_ld;
-          if (update_record(W, BUY, sym, seller_account_id, buyer_account_id,
+          if (update_record(W, BUY, sym, sym_key, seller_account_id, buyer_account_id,
                             matched_amount_ld, matched_limit_ld) < 0) {
             return -1;
           }
@@ -513,7 +444,7 @@ int match_order (work& W, std::string& return_order_id,
         else { // goods all sold
           matched_amount_ld = buyer_amount_ld;
           buyer_amount_ld = 0; // seller's good sold out
-          if (update_record(W, BUY, sym, seller_account_id, buyer_account_id,
+          if (update_record(W, BUY, sym, sym_key, seller_account_id, buyer_account_id,
                             matched_amount_ld, matched_limit_ld) < 0) {
             return -1;
           }
@@ -527,14 +458,7 @@ int match_order (work& W, std::string& return_order_id,
       if (1) {
 #endif
         // get current number of orders for seller
-#if 0
-        sql = "SELECT COUNT(*) FROM OPENED_ORDER WHERE ACCOUNT_ID = " +
-              W.quote(buyer_account_id) + ";";
-#else
-        sql = "SELECT NUM FROM ORDER_NUM WHERE ACCOUNT_ID = " +
-              W.quote(buyer_account_id) + ";";
-#endif
-        R = W.exec(sql);
+        R = W.prepared(STMT_SELECT_ORDER_NUM)(buyer_account_id).exec();
         res = R.begin();
 #if 1
         if (res == R.end()) { // no record
@@ -543,25 +467,16 @@ int match_order (work& W, std::string& return_order_id,
 #endif
         // seller order id is his current number of opened orders plus 1
         /*   TODO: ATT   */
-        order_id = std::to_string(res[0].as<long long>()+1);
+        order_id = res[0].as<long long>()+1;
         return_order_id = order_id;
         
         time_t curr_time = time(NULL);
         // store order into database for future match
-        sql = "INSERT INTO OPENED_ORDER ";
-        sql += "(ACCOUNT_ID, ORDER_ID, SYM, AMOUNT, PRICE, TIME) VALUES (";
-        sql += W.quote(buyer_account_id) + ", ";
-        sql += W.quote(order_id) + ", ";
-        sql += W.quote(sym) + ", ";
-        sql += W.quote(std::to_string(buyer_amount_ld)) + ", ";
-        sql += W.quote(limit) + ", ";
-        sql += W.quote(std::to_string(curr_time)) + ");";
-        W.exec(sql);
+        W.prepared(STMT_INSERT_OPENED)(buyer_account_id)(order_id)(sym)
+                  (buyer_amount_ld)(limit)(curr_time).exec();
 #if 1
         // update NUM in ORDER_NUM
-        sql = "UPDATE ORDER_NUM SET NUM = " + W.quote(order_id) +
-              " WHERE ACCOUNT_ID = " + W.quote(buyer_account_id) + ";";
-        W.exec(sql);
+        W.prepared(STMT_UPDATE_ORDER_NUM)(buyer_account_id)(order_id).exec();
 #endif
       }
     }
@@ -581,111 +496,41 @@ int match_order (work& W, std::string& return_order_id,
 
 
 /*   place incoming order and check if there is a match   */
-void place_order (int num, std::string account_id,
-                  std::string sym, std::string amount,
-                  std::string limit, std::string* response) {
+void place_order (order_command cmd) {
+  long long account_id = cmd.account_id;
+  long long order_id = -1;
   try {
-    std::string sql;
     result R;
     result::const_iterator res;
-    long long amount_ld;
-    long double limit_ld = std::stold(limit);
-    std::string order_id;
-    // connect to the database
-    // exchange_db is the host name used between containers
-#if DOCKER
-    connection C("dbname=exchange user=postgres password=psql " \
-                 "host=exchange_db port=5432");
-#else
-    connection C("dbname=exchange user=postgres password=psql ");
-#endif
-    work W(C);
-    
-    try {
-      // check if the amount value is valid
-      amount_ld = std::stoll(amount);
-      if (amount_ld == 0) { // invalid amount
-        std::lock_guard<std::mutex> lck (mtx);
-        *response += "@" + std::to_string(num) + "*" + "  <error sym=\"" + sym +
-                     "\" amount=\"" + std::to_string(abs(std::stoll(amount))) +
-                     "\" limit=\"" + limit + "\">Invalid amount</error>\n";
-        return;
-      }
-      if (std::stold(limit) <= 0) { // invalid price
-        std::lock_guard<std::mutex> lck (mtx);
-        *response += "@" + std::to_string(num) + "*" + "  <error sym=\"" + sym +
-                     "\" amount=\"" + std::to_string(abs(std::stoll(amount))) +
-                     "\" limit=\"" + limit + "\">Invalid limit</error>\n";
-        return;
-      }
-    }
-    catch (std::exception& e) { // invalid account or balance format
-      std::lock_guard<std::mutex> lck (mtx);
-      *response += "@" + std::to_string(num) + "*" + "  <error sym=\"" + sym +
-                   "\" amount=\"" + std::to_string(abs(std::stoll(amount))) +
-                   "\" limit=\"" + limit + "\">\n" \
-                   "    Invalid amount or limit\n  </error>\n";
-      return;
-    }
-#if 1 
-    // check if the symbol is currently in the market
-    sql = "SELECT COLUMN_NAME FROM information_schema.COLUMNS "\
-          "WHERE TABLE_NAME = 'account';";
-    R = W.exec(sql);
-    bool column_exist = false;
-    for (res = R.begin(); res != R.end(); ++res) {
-      for (result::tuple::const_iterator field = res->begin();
-           field != res->end(); ++field) {
-        if (field->c_str() == sym) {
-          column_exist = true;
-          break; // column exists, break;
-        }
-      }
-    }
-    if (column_exist == false) { // column indicated by sym does not exist
-      // add new column, shares of a symbol should not be negative
-      sql = "ALTER TABLE ACCOUNT ADD COLUMN \"" + sym +
-            "\" BIGINT NOT NULL DEFAULT 0 CHECK(\"" + sym + "\">=0);";
-      W.exec(sql);
+    long long amount_ld = cmd.amount;
+    long long limit_ld = cmd.price;
+    // take a connection of the pool
+    db_lease lease;
+    // a buy puts the symbol in the market if it is not yet; nobody holds
+    // shares of a symbol which is not, a sell of it fails without storing it
+    long long sym_key = NO_SYMBOL_KEY;
+    if (amount_ld > 0 || cmd.sym_id >= 0) {
+      sym_key = symbol_key(lease.conn, cmd.sym_id, cmd.sym);
     }
-#endif
+    work W(*lease.conn);
     
     // check if seller's sym share is enough
     if (amount_ld < 0) { // SELL
-      sql = "SELECT \"" + sym + "\" FROM ACCOUNT WHERE ACCOUNT_ID = ";
-      sql += W.quote(account_id) + ";";
-      R = W.exec(sql);
-      /*   TODO: pay attention to possible segfault   */
-      res = R.begin();
-      if (res == R.end()) {
-#if DEBUG
-        std::cerr << "1" << std::endl;
-#endif
-      }
-      long long new_shares_ld = res[0].as<long long>() + amount_ld;
+      long long new_shares_ld = position_shares(W, account_id, sym_key) + amount_ld;
       
       if (new_shares_ld < 0) {
         // insufficient shares, cannot place order
-        std::lock_guard<std::mutex> lck (mtx);
-        *response += "@" + std::to_string(num) + "*" + "  <error sym=\"" + sym +
-                     "\" amount=\"" + std::to_string(abs(std::stoll(amount))) + 
-                     "\" limit=\"" + limit + "\">\n" \
-                     "    Shares of symbol not enough\n  </error>\n";
+        add_order_result(cmd, RESULT_ORDER_ERROR, ERR_SHARES, -1);
         return;
       }
       
       // deduce shares from seller's account
-      sql = "UPDATE ACCOUNT SET \"" + sym + "\" = " +
-            W.quote(std::to_string(new_shares_ld)) +
-            " WHERE ACCOUNT_ID = " + W.quote(account_id) + ";";
-      W.exec(sql);
+      W.prepared(STMT_UPDATE_SHARES)(account_id)(sym_key)(new_shares_ld).exec();
     }
     
     else { // BUY
       // get current balance, check if there is enough funds
-      sql = "SELECT BALANCE FROM ACCOUNT WHERE ACCOUNT_ID = " +
-            W.quote(account_id) + ";";
-      R = W.exec(sql);
+      R = W.prepared(STMT_SELECT_BALANCE)(account_id).exec();
       /*   TODO: pay attention to possible segfault   */
       res = R.begin();
       if (res == R.end()) {
@@ -694,64 +539,41 @@ void place_order (int num, std::string account_id,
 #endif
       }
       /*   new balance ha?   */
-      long double new_balance_ld = res[0].as<long double>() - amount_ld * limit_ld;
+      long long cost_ld;
+      long long new_balance_ld = -1;
+      if (!__builtin_mul_overflow(amount_ld, limit_ld, &cost_ld)) {
+        new_balance_ld = price_ticks(res[0].as<std::string>()) - cost_ld;
+      }
       if (new_balance_ld < 0) {
         // insufficient funds, cannot place order
-        std::lock_guard<std::mutex> lck (mtx);
-        *response += "@" + std::to_string(num) + "*" + "  <error sym=\"" + sym +
-                     "\" amount=\"" + std::to_string(abs(std::stoll(amount))) +
-                     "\" limit=\"" + limit + "\">\n" \
-                     "    Insufficient funds\n  </error>\n";
+        add_order_result(cmd, RESULT_ORDER_ERROR, ERR_FUNDS, -1);
         return;
       }
       
       // update balance of buyer's account
-      sql = "UPDATE ACCOUNT SET BALANCE = " +
-            W.quote(set_precision(new_balance_ld)) +
-            " WHERE ACCOUNT_ID = " + W.quote(account_id) + ";";
-      W.exec(sql);
+      W.prepared(STMT_UPDATE_BALANCE)(account_id)(format_price(new_balance_ld)).exec();
     }
     
     // match order and update records
-    int stat = match_order(W, order_id, account_id,
-                           sym, amount, limit, response);
+    int stat = match_order(W, order_id, cmd, sym_key);
     if (stat == -1) {
-      std::lock_guard<std::mutex> lck (mtx);
-      *response += "@" + std::to_string(num) + "*" + "  <error sym=\"" + sym +
-                   "\" amount=\"" + std::to_string(abs(std::stoll(amount))) +
-                   "\" limit=\"" + limit + "\">\n" \
-                   "    Order does not exist\n  </error>\n";
+      add_order_result(cmd, RESULT_ORDER_ERROR, ERR_ORDER_RECORD, -1);
       return;
     }
     else if (stat == -2) {
-      std::lock_guard<std::mutex> lck (mtx);
-      *response += "@" + std::to_string(num) + "*" + "  <error sym=\"" + sym +
-                   "\" amount=\"" + std::to_string(abs(std::stoll(amount))) +
-                   "\" limit=\"" + limit + "\">\n" \
-                   "    Unable to match order\n  </error>\n";
+      add_order_result(cmd, RESULT_ORDER_ERROR, ERR_MATCH, -1);
       return;
     }
-    if (1) {
-      std::lock_guard<std::mutex> lck (mtx);
-      *response += "@" + std::to_string(num) + "*" + "  <opened id=\"" + order_id
-                   + "\" sym=\"" + sym + "\" amount=\"" +
-                   std::to_string(abs(std::stoll(amount))) +
-                   "\" limit=\"" + limit + "\"/>\n";
-    }
     W.commit();
-    C.disconnect();
   }
   catch (std::exception& e) {
 #if DEBUG
     std::cerr << "place_order: " << e.what() << std::endl;
 #endif
-    std::lock_guard<std::mutex> lck (mtx);
-    *response += "@" + std::to_string(num) + "*" + "  <error sym=\"" + sym +
-                 "\" amount=\"" + std::to_string(abs(std::stoll(amount))) +
-                 "\" limit=\"" + limit +
-                 "\">Invalid request!</error>\n";
+    add_order_result(cmd, RESULT_ORDER_ERROR, ERR_ORDER, -1);
     return;
   }
+  add_order_result(cmd, RESULT_OPENED, ERR_NONE, order_id);
   return;
 }
 
@@ -761,41 +583,29 @@ void place_order (int num, std::string account_id,
 
 
 /*   look for order records   */
-void query_order (int num, std::string account_id, std::string order_id,
-                  std::string* response) {
+void query_order (order_command cmd) {
+  long long account_id = cmd.account_id;
+  op_result status = make_result(RESULT_STATUS, ERR_NONE, cmd.order_id);
   try {
-    std::string sql;
     result R;
     result::const_iterator res;
     bool canceled = false;
     long long opened_amount_ld;
     
-    // connect to the database
-    // exchange_db is the host name used between containers
-#if DOCKER
-    connection C("dbname=exchange user=postgres password=psql " \
-                 "host=exchange_db port=5432");
-#else
-    connection C("dbname=exchange user=postgres password=psql ");
-#endif
-    work W(C);
+    // take a connection of the pool
+    db_lease lease;
+    work W(*lease.conn);
     
     // check if the order exists
-    sql = "SELECT COUNT(*) FROM OPENED_ORDER WHERE ACCOUNT_ID = " +
-          W.quote(account_id) + " AND ORDER_ID = " + W.quote(order_id) + ";";
-    R = W.exec(sql);
+    R = W.prepared(STMT_OPENED_COUNT)(account_id)(cmd.order_id).exec();
     res = R.begin();
     if (res[0].as<int>() == 0) { // order queried does not exist
-      std::lock_guard<std::mutex> lck (mtx);
-      *response += "@" + std::to_string(num) + "*" + "  <error id=\"" + order_id +
-                   "\">Order does not exist</error>\n";
+      add_result(cmd, make_result(RESULT_ERROR, ERR_NO_ORDER, cmd.order_id));
       return;
     }
     
     // check if the order is canceled
-    sql = "SELECT STATUS FROM CLOSED_ORDER WHERE ACCOUNT_ID = " +
-          W.quote(account_id) + " AND ORDER_ID = " + W.quote(order_id) + ";";
-    R = W.exec(sql);
+    R = W.prepared(STMT_CLOSED_STATUS)(account_id)(cmd.order_id).exec();
     for (res = R.begin(); res != R.end(); ++res) {
       if (res[0].as<int>() == 1) { // order has been canceled
         canceled = true;
@@ -803,72 +613,55 @@ void query_order (int num, std::string account_id, std::string order_id,
       }
     }
     
-    if (1) {
-      std::lock_guard<std::mutex> lck (mtx);
-      *response += "@" + std::to_string(num) + "*" + "  <status id=\"" + order_id + "\">\n";
-      sql = "SELECT * FROM CLOSED_ORDER WHERE ACCOUNT_ID = " + W.quote(account_id) +
-            " AND ORDER_ID = " + W.quote(order_id) + ";";
-      R = W.exec(sql);
-      if (canceled == false) { // no canceling record
-        for (res = R.begin(); res != R.end(); ++res) {
-          //std::lock_guard<std::mutex> lck (mtx);
-          *response += "    <executed shares=\"" +
-                       std::to_string(abs(res[3].as<long long>())) +
-                       "\" price=\"" + res[4].as<std::string>() +
-                       "\" time=\"" + res[5].as<std::string>() + "\"/>\n";
-        }
-        // check if the order is still open
-        sql = "SELECT AMOUNT, PRICE FROM OPENED_ORDER WHERE ACCOUNT_ID = " +
-              W.quote(account_id) + " AND ORDER_ID = " + W.quote(order_id) + ";";
-        R = W.exec(sql);
-        /*   to avoid segfault   */
-        res = R.begin();
-        if (res == R.end()) {
+    R = W.prepared(STMT_CLOSED_ORDERS)(account_id)(cmd.order_id).exec();
+    if (canceled == false) { // no canceling record
+      for (res = R.begin(); res != R.end(); ++res) {
+        status.items.push_back(make_item(ITEM_EXECUTED, ERR_NONE, account_id,
+                                         res[3].as<long long>(),
+                                         price_ticks(res[4].as<std::string>()),
+                                         res[5].as<long long>()));
+      }
+      // check if the order is still open
+      R = W.prepared(STMT_OPENED_AMOUNT)(account_id)(cmd.order_id).exec();
+      /*   to avoid segfault   */
+      res = R.begin();
+      if (res == R.end()) {
 #if DEBUG
-          std::cerr << "3" << std::endl;
+        std::cerr << "3" << std::endl;
 #endif
-        }
-        opened_amount_ld = res[0].as<long long>();
-        if (opened_amount_ld != 0) { // the order is still open
-          //std::lock_guard<std::mutex> lck (mtx);
-          *response += "    <open shares=\"" +
-                       std::to_string(abs(res[0].as<long long>())) + "\"/>\n";
-        }
       }
-      else { // order has been canceled
-        std::lock_guard<std::mutex> lck (mtx);
-        *response += "@" + std::to_string(num) + "*";
-        for (res = R.begin(); res != R.end(); ++res) {
-          if (res[2].as<int>() == 0) { // executed order
-            //std::lock_guard<std::mutex> lck (mtx);
-            *response += "    <executed shares=\"" +
-                         std::to_string(abs(res[3].as<long long>())) +
-                         "\" price=\"" + res[4].as<std::string>() +
-                         "\" time=\"" + res[5].as<std::string>() + "\"/>\n";
-          }
-          else { // canceled order
-            //std::lock_guard<std::mutex> lck (mtx);
-            *response += "    <canceled shares=\"" +
-                         std::to_string(abs(res[3].as<long long>())) + "\" time=\"" +
-                         res[5].as<std::string>() + "\"/>\n";
-            break; // ought to be the last one
-          }
+      opened_amount_ld = res[0].as<long long>();
+      if (opened_amount_ld != 0) { // the order is still open
+        status.items.push_back(make_item(ITEM_OPEN, ERR_NONE, account_id,
+                                         opened_amount_ld, 0, 0));
+      }
+    }
+    else { // order has been canceled
+      for (res = R.begin(); res != R.end(); ++res) {
+        if (res[2].as<int>() == 0) { // executed order
+          status.items.push_back(make_item(ITEM_EXECUTED, ERR_NONE, account_id,
+                                           res[3].as<long long>(),
+                                           price_ticks(res[4].as<std::string>()),
+                                           res[5].as<long long>()));
+        }
+        else { // canceled order
+          status.items.push_back(make_item(ITEM_CANCELED, ERR_NONE, account_id,
+                                           res[3].as<long long>(), 0,
+                                           res[5].as<long long>()));
+          break; // ought to be the last one
         }
       }
-      *response += "  </status>\n";
     }
     W.commit();
-    C.disconnect();
   }
   catch (std::exception& e) {
 #if DEBUG
     std::cerr << "query_order: " << e.what() << std::endl;
 #endif
-    std::lock_guard<std::mutex> lck (mtx);
-    *response += "@" + std::to_string(num) + "*" + "  <error id=\"" + order_id +
-                 "\">Unable to query order</error>\n";
+    add_result(cmd, make_result(RESULT_ERROR, ERR_QUERY, cmd.order_id));
     return;
   }
+  add_result(cmd, status);
   return;
 }
 
@@ -878,95 +671,52 @@ void query_order (int num, std::string account_id, std::string order_id,
 
 
 /*   cancel opened order, i.e. update OPENED_ORDER and CLOSED_ORDER   */
-void cancel_order (int num, std::string account_id, std::string order_id,
-                   std::string* response) {
+void cancel_order (order_command cmd) {
+  long long account_id = cmd.account_id;
+  op_result canceled = make_result(RESULT_CANCELED, ERR_NONE, cmd.order_id);
   try {
-    std::string sql;
     result R;
     result::const_iterator res;
     std::string sym;
     long long opened_amount_ld;
-    long double opened_limit_ld;
+    long long opened_limit_ld;
     long long new_amount_ld;
-    long double new_balance_ld;
-    bool canceled = false;
+    long long new_balance_ld;
     
-    // connect to the database
-    // exchange_db is the host name used between containers
-#if DOCKER
-    connection C("dbname=exchange user=postgres password=psql " \
-                 "host=exchange_db port=5432");
-#else
-    connection C("dbname=exchange user=postgres password=psql ");
-#endif
-    work W(C);
+    // take a connection of the pool
+    db_lease lease;
+    work W(*lease.conn);
     
     /*   1. update OPENED_ORDER, set amount to 0   */
-    sql = "SELECT SYM, AMOUNT, PRICE FROM OPENED_ORDER WHERE ACCOUNT_ID = " +
-          W.quote(account_id) + " AND ORDER_ID = " + W.quote(order_id) + ";";
-    R = W.exec(sql);
+    R = W.prepared(STMT_OPENED_ORDER)(account_id)(cmd.order_id).exec();
     res = R.begin();
     if (res == R.end()) { // order does not exist
-      std::lock_guard<std::mutex> lck (mtx);
-      *response += "@" + std::to_string(num) + "*" + "  <error id=\"" + order_id +
-                   "\">Order does not exist</error>\n";
+      add_result(cmd, make_result(RESULT_ERROR, ERR_NO_ORDER, cmd.order_id));
       return;
     }
     sym = res[0].as<std::string>();
     opened_amount_ld = res[1].as<long long>();
-    opened_limit_ld = res[2].as<long double>();
+    opened_limit_ld = price_ticks(res[2].as<std::string>());
     
     if (opened_amount_ld == 0) {
-      std::lock_guard<std::mutex> lck (mtx);
-      *response += "@" + std::to_string(num) + "*" + "  <error id=\"" + order_id +
-                   "\">Order is complete, nothing to cancel</error>\n";
+      add_result(cmd, make_result(RESULT_ERROR, ERR_COMPLETE, cmd.order_id));
       return;
     }
     else if (opened_amount_ld < 0) { // canceling a SELL order, refund shares
       // clear amount to indicate that the order is canceled
-#if 0
-      sql = "UPDATE OPENED_ORDER SET AMOUNT = 0 WHERE ACCOUNT_ID = " + 
-            W.quote(account_id) + " AND ORDER_ID = " + W.quote(order_id) + ";";
-#else
-      sql = "DELETE FROM OPENED_ORDER WHERE ACCOUNT_ID = " +
-            W.quote(account_id) +
-            " AND ORDER_ID = " + W.quote(order_id) + ";";
-#endif
-      W.exec(sql);
+      W.prepared(STMT_DELETE_OPENED)(account_id)(cmd.order_id).exec();
       
       // add canceled shares to seller's account
-      sql = "SELECT \"" + sym + "\" FROM ACCOUNT " +
-            "WHERE ACCOUNT_ID = " + W.quote(account_id) + ";";
-      R = W.exec(sql);
-      /*   TODO: pay attention to possible segfault   */
-      res = R.begin();
-      if (res == R.end()) {
-#if DEBUG
-        std::cerr << "4" << std::endl;
-#endif
-      }
+      long long sym_key = stored_symbol_key(W, sym);
       /*   TODO: pay attention to negative values   */
-      new_amount_ld = res[0].as<long long>() - opened_amount_ld;
-      sql = "UPDATE ACCOUNT SET \"" + sym + "\" = " +
-            W.quote(std::to_string(new_amount_ld)) +
-            " WHERE ACCOUNT_ID = " + W.quote(account_id) + ";";
-      W.exec(sql);
+      new_amount_ld = position_shares(W, account_id, sym_key) - opened_amount_ld;
+      W.prepared(STMT_UPDATE_SHARES)(account_id)(sym_key)(new_amount_ld).exec();
     }
     else { // canceling a BUY order, refund amount * limit
       // clear amount to indicate that the order is canceled
-#if 0
-      sql = "UPDATE OPENED_ORDER SET AMOUNT = 0 WHERE ACCOUNT_ID = " +
-            W.quote(account_id) + " AND ORDER_ID = " + W.quote(order_id) + ";";
-#else
-      sql = "DELETE FROM OPENED_ORDER WHERE ACCOUNT_ID = " +
-            W.quote(account_id) +
-            " AND ORDER_ID = " + W.quote(order_id) + ";";
-#endif
-      W.exec(sql);
+      W.prepared(STMT_DELETE_OPENED)(account_id)(cmd.order_id).exec();
       // add canceled amount * limit to buyer's account
-      sql = "SELECT BALANCE FROM ACCOUNT WHERE ACCOUNT_ID = " +
-            W.quote(account_id) + ";";
-      R = W.exec(sql);
+      R = W.prepared(STMT_SELECT_BALANCE)(account_id).exec();
       /*   TODO: pay attention to possible segfault   */
       res = R.begin();
       if (res == R.end()) {
@@ -974,63 +724,141 @@ void cancel_order (int num, std::string account_id, std::string order_id,
         std::cerr << "5" << std::endl;
 #endif
       }
-      new_balance_ld = res[0].as<long double>() + (opened_amount_ld * opened_limit_ld);
+      new_balance_ld = price_ticks(res[0].as<std::string>()) + (opened_amount_ld * opened_limit_ld);
       /*   TODO: double check   */
-      sql = "UPDATE ACCOUNT SET BALANCE = " + W.quote(set_precision(new_balance_ld)) +
-            " WHERE ACCOUNT_ID = " + W.quote(account_id) + ";";
-      W.exec(sql);
+      W.prepared(STMT_UPDATE_BALANCE)(account_id)(format_price(new_balance_ld)).exec();
     }
     
     
     
     /*   2. update CLOSED_ORDER, add cancel info   */
     time_t curr_time = time(NULL);
-    sql = "INSERT INTO CLOSED_ORDER " \
-          "(ACCOUNT_ID, ORDER_ID, STATUS, SHARES, PRICE, TIME) VALUES (" +
-          W.quote(account_id) + ", " +
-          W.quote(order_id) + ", 1, " + // order is canceled (0 is executed)
-          W.quote(std::to_string(opened_amount_ld)) + ", " +
-          W.quote(set_precision(opened_limit_ld)) + ", " +
-          W.quote(std::to_string(curr_time)) + ");";
-    W.exec(sql);
+    // status 1, order is canceled (0 is executed)
+    W.prepared(STMT_INSERT_CLOSED)(account_id)(cmd.order_id)(1)(opened_amount_ld)
+              (format_price(opened_limit_ld))(curr_time).exec();
     
     // get all executed records identified by account_id and order_id
-    if (1) {
-      *response += "@" + std::to_string(num) + "*" + 
-                   "  <canceled id=\"" + order_id + "\">\n";
-      sql = "SELECT * FROM CLOSED_ORDER WHERE ACCOUNT_ID = " +
-            W.quote(account_id) + " AND ORDER_ID = " + W.quote(order_id) + ";";
-      R = W.exec(sql);
-      for (res = R.begin(); res != R.end(); ++res) {
-        if (res[2].as<int>() == 0) { // executed order
-          //std::lock_guard<std::mutex> lck (mtx);
-          *response += "    <executed shares=\"" +
-                       std::to_string(abs(res[3].as<long long>())) +
-                       "\" price=\"" + res[4].as<std::string>() +
-                       "\" time=\"" + res[5].as<std::string>() + "\"/>\n";
-        }
-        else { // canceled order
-          //std::lock_guard<std::mutex> lck (mtx);
-          *response += "    <canceled shares=\"" +
-                       std::to_string(abs(res[3].as<long long>())) +
-                       "\" time=\"" + res[5].as<std::string>() + "\"/>\n";
-          break; // ought to be the last one
-        }
+    R = W.prepared(STMT_CLOSED_ORDERS)(account_id)(cmd.order_id).exec();
+    for (res = R.begin(); res != R.end(); ++res) {
+      if (res[2].as<int>() == 0) { // executed order
+        canceled.items.push_back(make_item(ITEM_EXECUTED, ERR_NONE, account_id,
+                                           res[3].as<long long>(),
+                                           price_ticks(res[4].as<std::string>()),
+                                           res[5].as<long long>()));
+      }
+      else { // canceled order
+        canceled.items.push_back(make_item(ITEM_CANCELED, ERR_NONE, account_id,
+                                           res[3].as<long long>(), 0,
+                                           res[5].as<long long>()));
+        break; // ought to be the last one
       }
-      *response += "@" + std::to_string(num) + "*" + "  </canceled>\n";
     }
     W.commit();
-    C.disconnect();
   }
   catch (std::exception& e) {
 #if DEBUG
     std::cerr << "cancel_order: " << e.what() << std::endl;
 #endif
-    std::lock_guard<std::mutex> lck (mtx);
-    *response += "@" + std::to_string(num) + "*" + "  <error id=\"" + order_id +
-                 "\">Unable to cancel order</error>\n";
+    add_result(cmd, make_result(RESULT_ERROR, ERR_CANCEL, cmd.order_id));
+    return;
+  }
+  add_result(cmd, canceled);
+  return;
+}
+
+
+
+
+
+
+/*   send the results which are done, up to the first one which is not   */
+// called with batch_mtx held, so chunks go out in order; nothing is sent
+// unless the account exists, otherwise the response is one error
+void send_done (transactions_batch* b) {
+  result_sink* sink = b->sink;
+  std::size_t last = sink->sent;
+
+  if (b->account != ACCOUNT_FOUND) {
     return;
   }
+  while (last < b->done.size() && b->done[last]) {
+    ++last;
+  }
+  if (last == sink->sent) {
+    return; // the next result in order is still being worked on
+  }
+  std::string* chunk = new std::string;
+  chunk->reserve(sizeof("<results>\n") + xml_size(*b->results, sink->sent, last));
+  if (sink->sent == 0) {
+    APPEND_LITERAL(chunk, "<results>\n");
+  }
+  render_xml(*b->results, sink->sent, last, chunk);
+  sink->sent = last;
+  sink->send(sink, chunk);
+  return;
+}
+
+
+
+
+
+
+/*   child num of the batch is done, its slot has been filled   */
+// called with batch_mtx held
+void child_done (transactions_batch* b, long long num) {
+  if (b->sink != NULL) { // otherwise results are read once every child is done
+    b->done[num] = 1;
+    send_done(b);
+  }
+  return;
+}
+
+
+
+
+
+
+/*   a task of the batch has finished, wake close_transactions after the last   */
+// called with batch_mtx held, the batch may be deleted once it is released
+void task_done (transactions_batch* b) {
+  if (--b->running == 0) {
+    b->idle.notify_all();
+  }
+  return;
+}
+
+
+
+
+
+
+/*   execute a decoded child of a batch, runs in its thread pool   */
+void run_order (transactions_batch* b, order_command cmd) {
+  if (cmd.type == CHILD_ORDER) { // <order sym="" amount="" limit=""/>
+    place_order(cmd);
+  }
+  else if (cmd.type == CHILD_CANCEL) { // <cancel id=""/>
+    cancel_order(cmd);
+  }
+  else { // <query id=""/>
+    query_order(cmd);
+  }
+  std::lock_guard<std::mutex> lck (b->batch_mtx);
+  child_done(b, cmd.num);
+  task_done(b);
+  return;
+}
+
+
+
+
+
+
+/*   hand a decoded child of a batch to the executor   */
+// called with batch_mtx held
+void post_order (transactions_batch* b, const order_command& cmd) {
+  ++b->running;
+  boost::asio::post(*executor, boost::bind(run_order, b, cmd));
   return;
 }
 
@@ -1039,34 +867,36 @@ void cancel_order (int num, std::string account_id, std::string order_id,
 
 
 
-/*   re-assemble response XML according to the incoming order   */
-void reorder_response (std::string* response) {
+/*   check the account of a batch, then run what was added meanwhile   */
+void check_batch_account (transactions_batch* b) {
+  int account;
   try {
-    std::stringstream ss(*response);
-    std::string xml_child;
-    std::size_t pos;
-    std::unordered_map <long long, std::string> map;
-    
-    *response = "";
-    while (std::getline(ss, xml_child, '@')) { // parse and re-order response
-      if ((pos = xml_child.find("*")) != std::string::npos) {
-        long long num = std::stoll(xml_child.substr(0, pos));
-        xml_child = xml_child.substr(pos+1);
-        std::pair <long long, std::string> temp_pair;
-        temp_pair.first = num;
-        temp_pair.second = xml_child;
-        map.insert(temp_pair);
-      }
-    }
-    for (int i = 0; i < map.size(); ++i) {
-      *response += map[i];
-    }
+    // take a connection of the pool
+    db_lease lease;
+    work W(*lease.conn);
+    result R = W.prepared(STMT_ACCOUNT_COUNT)(b->account_id).exec();
+    W.commit();
+    result::const_iterator res = R.begin();
+    account = res[0].as<int>() == 0 ? ACCOUNT_MISSING : ACCOUNT_FOUND;
   }
   catch (std::exception& e) {
 #if DEBUG
-    std::cerr << "reorder_response: " << e.what() << std::endl;
+    std::cerr << "check_batch_account: " << e.what() << std::endl;
 #endif
+    account = ACCOUNT_FAILED;
+  }
+  std::lock_guard<std::mutex> lck (b->batch_mtx);
+  b->account = account;
+  if (account == ACCOUNT_FOUND) {
+    for (std::size_t i = 0; i < b->pending.size(); ++i) {
+      post_order(b, b->pending[i]);
+    }
+    if (b->sink != NULL) { // children which could not be decoded are done
+      send_done(b);
+    }
   }
+  b->pending.clear();
+  task_done(b);
   return;
 }
 
@@ -1075,172 +905,218 @@ void reorder_response (std::string* response) {
 
 
 
-/*   if root node of XML is <transaction>   */
-int handle_transactions (xmlpp::TextReader& reader, std::string* response) {
+/*   start executing the children of a <transactions> of account_id   */
+// children are added one by one with add_child or add_transaction, each one
+// fills its own slot in whatever order they finish; with a sink the results
+// are also sent as they are done
+transactions_batch* open_transactions (long long account_id, result_slots* results,
+                                       result_sink* sink) {
+  transactions_batch* b = new transactions_batch;
+  b->account_id = account_id;
+  b->results = results;
+  b->sink = sink;
+  b->running = 1;
+  b->account = ACCOUNT_CHECKING;
+  
+  // the account is checked while the first children are being added
+  boost::asio::post(*executor, boost::bind(check_batch_account, b));
+  return b;
+}
+
+
+
+
+
+
+/*   execute a decoded child once the account is known to exist   */
+void add_transaction (transactions_batch* b, const order_command& cmd) {
+  std::lock_guard<std::mutex> lck (b->batch_mtx);
+  if (b->account == ACCOUNT_CHECKING) {
+    b->pending.push_back(cmd);
+  }
+  else if (b->account == ACCOUNT_FOUND) {
+    post_order(b, cmd);
+  }
+  return;
+}
+
+
+
+
+
+
+/*   wait for every child of the batch, the batch is deleted   */
+// only this request waits, the executor goes on with the children of others
+int close_transactions (transactions_batch* b) {
+  int stat = 0;
+  
+  {
+    std::unique_lock<std::mutex> lck (b->batch_mtx);
+    while (b->running != 0) {
+      b->idle.wait(lck);
+    }
+  }
+  if (b->account == ACCOUNT_MISSING) { // account does not exist
+    stat = -3;
+  }
+  else if (b->account == ACCOUNT_FAILED) { // unexpected exception
+    stat = -2;
+  }
+  delete b;
+  return stat;
+}
+
+
+
+
+
+
+/*   execute the decoded children of a <transactions>   */
+int run_transactions (long long account_id, const std::vector<order_command>& cmds) {
   try {
-    std::string account_id;
-    std::string sym;
-    std::string amount;
-    std::string limit;
-    std::string order_id;
-    std::vector <std::string> id_arr;
-    std::vector <std::string> num_shares_arr;
-    bool trans_open = false;
-    boost::asio::thread_pool handler(NUM_THREAD);
-    long long num = 0;
-     
-    do {
-      if (reader.get_name() == "transactions") {
-        if (trans_open == true) {
-          break; // encounter </transaction>, finish
-        }
-        // check if the account exists
-        if (reader.get_attribute_count() == 1) { // if node has 1 attribute
-          reader.move_to_first_attribute();
-          if (reader.get_name() == "account") { // attribute should be "account"
-            account_id = reader.get_value();
-          }
-          else {
-            return -1; // invalid XML request
-          }
-        }
-        else {
-          return -1; // invalid XML request
-        }
-        // connect to the database
-        // exchange_db is the host name used between containers
-#if DOCKER
-        connection C("dbname=exchange user=postgres password=psql " \
-                     "host=exchange_db port=5432");
-#else
-        connection C("dbname=exchange user=postgres password=psql ");
-#endif
-        work W(C);
-        std::string sql = "SELECT COUNT(ACCOUNT_ID) FROM ACCOUNT " \
-                          "WHERE ACCOUNT_ID = " + W.quote(account_id) + ";";
-        result R = W.exec(sql);
-        W.commit();
-        C.disconnect();
-        result::const_iterator res = R.begin();
-        if (res[0].as<int>() == 0) { // account does not exist
-          return -3;
-        }
-        trans_open = true;
-      }
-      
-      
-      
-      /*   place order   */
-      else if (reader.get_name() == "order") {
-        if (reader.get_attribute_count() == 3) { // if node has 3 attribute
-          reader.move_to_first_attribute();
-          if (reader.get_name() == "sym") { // 1st attribute should be "sym"
-            sym = reader.get_value();
-          }
-          else {
-            return -1; // invalid XML request
-          }
-          
-          reader.move_to_next_attribute();
-          if (reader.get_name() == "amount") { // 2nd attribute should be "amount"
-            amount = reader.get_value();
-          }
-          else {
-            return -1; // invalid XML request
-          }
-          
-          reader.move_to_next_attribute();
-          if (reader.get_name() == "limit") { // 3rd attribute should be "limit"
-            limit = reader.get_value();
-          }
-          else {
-            return -1; // invalid XML request
-          }
-          // place order
-#if THREAD_POOL
-          boost::asio::post(handler, boost::bind(place_order,
-                                                 num, account_id, sym, amount,
-                                                 limit, response));
-#else
-          place_order(num, account_id, sym, amount, limit, response);
-#endif
-        }
-        else { // not 2 attributes, invalid XML request
-          return -1;
-        }
-      }
-      
-      
-      
-      /*   cancel order   */
-      else if (reader.get_name() == "cancel") {
-        if (reader.get_attribute_count() == 1) { // if node has 1 attribute
-          reader.move_to_first_attribute();
-          if (reader.get_name() == "id") { // attribute should be "id"
-            order_id = reader.get_value();
-          }
-          else {
-            return -1; // invalid XML request
-          }
-          // cancel order
-#if THREAD_POOL
-          boost::asio::post(handler, boost::bind(cancel_order,
-                                                 num, account_id,
-                                                 order_id, response));
-#else
-          cancel_order(num, account_id, order_id, response);
-#endif
-        }
-        else { // not 2 attributes, invalid XML request
-          return -1;
-        }
-      }
-      
-      
-      
-      /*   query order   */
-      else if (reader.get_name() == "query") {
-        if (reader.get_attribute_count() == 1) { // if node has 1 attribute
-          reader.move_to_first_attribute(); 
-          if (reader.get_name() == "id") { // attribute should be "id"
-            order_id = reader.get_value();
-          }
-          else {
-            return -1; // invalid XML request
-          }
-          // query order
-#if THREAD_POOL
-          boost::asio::post(handler, boost::bind(query_order,
-                                                 num, account_id,
-                                                 order_id, response));
-#else
-          query_order(num, account_id, order_id, response);
-#endif
-        }
-        else { // not 2 attributes, invalid XML request
-          return -1;
-	}
-      }
-      else if (reader.get_name() == "#text") {
-        continue; // ignore spaces
-      }
-      else {
-        return -1; // invalid XML request
-      }
-      ++num;
-    } while (reader.read()); // read nodes
-    /*   TODO: response reassembling   */
-    handler.join();
-    reorder_response(response);
+    transactions_batch* b = open_transactions(account_id, NULL, NULL);
+    for (std::size_t i = 0; i < cmds.size(); ++i) {
+      add_transaction(b, cmds[i]);
+    }
+    return close_transactions(b);
   }
   catch (std::exception& e) {
 #if DEBUG
-    std::cerr << "handle_transaction: " << e.what() << std::endl;
+    std::cerr << "run_transactions: " << e.what() << std::endl;
 #endif
     return -2; // unexpected exception
   }
-  return 0;
 }
 
 
 
+
+
+
+/*   decode one child of a <transactions>, its result goes into slot   */
+// returns false if it could not be decoded, slot holds the error then
+bool decode_transaction (const child_record& child, long long account_id,
+                         order_command& cmd, op_result* slot) {
+  int stat = decode_order(child, account_id, cmd);
+  cmd.result = slot;
+  if (stat == DECODE_OK) {
+    return true;
+  }
+  
+  /*   child element could not be decoded, nothing to execute   */
+  // the error is written into the text of the empty slot as sent
+  std::string* text = &slot->text;
+  if (child.type != CHILD_ORDER) {
+    APPEND_LITERAL(text, "  <error id=\"");
+    text->append(child.attr[0].ptr, child.attr[0].len);
+    APPEND_LITERAL(text, "\">Order does not exist</error>\n");
+    return false;
+  }
+  APPEND_LITERAL(text, "  <error sym=\"");
+  text->append(child.attr[0].ptr, child.attr[0].len);
+  APPEND_LITERAL(text, "\" amount=\"");
+  if (stat == DECODE_FORMAT) {
+    text->append(child.attr[1].ptr, child.attr[1].len);
+  }
+  else {
+    append_int(text, llabs(cmd.amount));
+  }
+  APPEND_LITERAL(text, "\" limit=\"");
+  text->append(child.attr[2].ptr, child.attr[2].len);
+  if (stat == DECODE_AMOUNT) { // invalid amount
+    APPEND_LITERAL(text, "\">Invalid amount</error>\n");
+  }
+  else if (stat == DECODE_PRICE) { // invalid price
+    APPEND_LITERAL(text, "\">Invalid limit</error>\n");
+  }
+  else if (stat == DECODE_FORMAT) { // invalid amount or limit format
+    APPEND_LITERAL(text, "\">\n    Invalid amount or limit\n  </error>\n");
+  }
+  else {
+    APPEND_LITERAL(text, "\">Invalid request!</error>\n");
+  }
+  return false;
+}
+
+
+
+
+
+
+/*   thread pool which executes the children of every request   */
+// set once at startup, before any request arrives
+void set_executor (boost::asio::thread_pool* pool) {
+  executor = pool;
+  return;
+}
+
+
+
+
+
+
+/*   slot for the next child of the batch, num is set to its position   */
+op_result* batch_slot (transactions_batch* b, long long& num) {
+  std::lock_guard<std::mutex> lck (b->batch_mtx);
+  num = b->results->size();
+  b->done.push_back(0);
+  return add_slot(b->results);
+}
+
+
+
+
+
+
+/*   decode the next child of a batch and execute it   */
+// a child which cannot be decoded is done right away, its slot holds the error
+void add_child (transactions_batch* b, const child_record& child) {
+  order_command cmd;
+  long long num;
+  op_result* slot = batch_slot(b, num);
+
+  if (decode_transaction(child, b->account_id, cmd, slot)) {
+    cmd.num = num;
+    add_transaction(b, cmd);
+  }
+  else {
+    std::lock_guard<std::mutex> lck (b->batch_mtx);
+    child_done(b, num);
+  }
+  return;
+}
+
+
+
+
+
+
+/*   if root node of XML is <transaction>   */
+// with a sink the results are sent to the client as they are done
+int handle_transactions (const parsed_request& req, result_slots* results,
+                         result_sink* sink) {
+  long long account_id;
+  
+  if (decode_id(req.account, account_id) != DECODE_OK) {
+    return -3; // not an account number, cannot exist
+  }
+  for (std::size_t i = 0; i < req.children.size(); ++i) {
+    int type = req.children[i].type;
+    if (type != CHILD_ORDER && type != CHILD_CANCEL && type != CHILD_QUERY) {
+      return -1; // invalid XML request
+    }
+  }
+  try {
+    transactions_batch* b = open_transactions(account_id, results, sink);
+    for (std::size_t i = 0; i < req.children.size(); ++i) {
+      add_child(b, req.children[i]);
+    }
+    return close_transactions(b);
+  }
+  catch (std::exception& e) {
+#if DEBUG
+    std::cerr << "handle_transactions: " << e.what() << std::endl;
+#endif
+    return -2; // unexpected exception
+  }
+}
@@ -1,13 +1,39 @@
 #include <vector>
-#ifdef HAVE_CONFIG_H
-#include <config.h>
-#endif
-#include <libxml++/libxml++.h>
-#include <libxml++/parsers/textreader.h>
 
+// boost library for thread pool
+#include <boost/asio/thread_pool.hpp>
 
+#include "request_parser.h"
+#include "order_command.h"
+#include "result.h"
 
-int handle_create (xmlpp::TextReader& reader, std::string* response);
 
-int handle_transactions (xmlpp::TextReader& reader, std::string* response);
+
+int run_create (const std::vector<create_command>& cmds);
+
+int handle_create (const parsed_request& req, result_slots* results);
+
+struct transactions_batch;
+
+void set_executor (boost::asio::thread_pool* pool);
+
+transactions_batch* open_transactions (long long account_id, result_slots* results,
+                                       result_sink* sink);
+
+void add_child (transactions_batch* b, const child_record& child);
+
+int close_transactions (transactions_batch* b);
+
+int run_transactions (long long account_id, const std::vector<order_command>& cmds);
+
+int handle_transactions (const parsed_request& req, result_slots* results,
+                         result_sink* sink);
+
+long long get_clock_time ();
+
+void render_results (int stat, const result_slots& results, const result_sink* sink,
+                     std::string* response);
+
+void execute_request (const char* data, long long len, std::string* response,
+                      result_sink* sink);
 
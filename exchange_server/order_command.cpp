@@ -0,0 +1,505 @@
+#include <string>
+#include <stdexcept>
+#include <mutex>
+#include <atomic>
+
+#include <limits.h>
+#include <string.h>
+
+#include "request_parser.h"
+#include "order_command.h"
+#include "scan_simd.h"
+
+/*   interned symbol, its block never moves once allocated   */
+struct symbol_entry {
+  const std::string* name;            // never changes once interned
+  std::atomic <long long> key;        // SYM_ID in the database, NO_SYMBOL_KEY until known
+};
+
+/*   open addressing index from the hash of a name to sym_id + 1, 0 if free   */
+// replaced by one twice as large when half full, an old one is kept
+// since a reader may still be probing it
+struct symbol_index {
+  std::size_t mask;
+  std::atomic <int>* slots;
+};
+
+std::mutex symbol_mtx;        // held by the writers only
+std::atomic <symbol_entry*> symbol_blocks[MAX_SYMBOL_BLOCKS];
+std::atomic <symbol_index*> symbol_lookup (NULL);
+int num_symbols = 0;
+
+
+
+/*   decimal integer with an optional sign   */
+// returns false if the text is not a number or does not fit in 64 bits
+bool parse_int (const char* p, long long len, long long& value) {
+  const char* end = p + len;
+  bool negative = false;
+  unsigned long long magnitude = 0;
+
+  if (p < end && (*p == '-' || *p == '+')) {
+    negative = (*p == '-');
+    ++p;
+  }
+  if (p == end) {
+    return false;
+  }
+  p += scan_digits(p, end, magnitude); // a long run goes on one by one
+  for (; p < end; ++p) {
+    if (*p < '0' || *p > '9' ||
+        magnitude > ((unsigned long long)LLONG_MAX - (*p - '0')) / 10) {
+      return false;
+    }
+    magnitude = magnitude * 10 + (*p - '0');
+  }
+  value = negative ? -(long long)magnitude : (long long)magnitude;
+  return true;
+}
+
+
+
+
+
+
+/*   decimal number with an optional sign and fraction, in ticks   */
+// digits beyond the tick are rounded half away from zero, like NUMERIC(20,2)
+bool parse_price (const char* p, long long len, long long& ticks) {
+  const char* end = p + len;
+  bool negative = false;
+  bool digits = false;
+  unsigned long long magnitude = 0;
+
+  if (p < end && (*p == '-' || *p == '+')) {
+    negative = (*p == '-');
+    ++p;
+  }
+  long long n = scan_digits(p, end, magnitude);
+  p += n;
+  digits = n > 0;
+  for (; p < end && *p >= '0' && *p <= '9'; ++p) { // a long run goes on one by one
+    if (magnitude > (unsigned long long)LLONG_MAX / 10) {
+      return false;
+    }
+    magnitude = magnitude * 10 + (*p - '0');
+  }
+  if (magnitude > (unsigned long long)LLONG_MAX / PRICE_SCALE) {
+    return false;
+  }
+  magnitude *= PRICE_SCALE;
+  if (p < end && *p == '.') {
+    unsigned long long place = PRICE_SCALE / 10;
+    bool rounded = false;
+    for (++p; p < end && *p >= '0' && *p <= '9'; ++p) {
+      if (place > 0) {
+        magnitude += place * (*p - '0');
+        place /= 10;
+      }
+      else if (!rounded) { // first digit below a tick
+        magnitude += (*p >= '5');
+        rounded = true;
+      }
+      digits = true;
+    }
+  }
+  if (p != end || !digits || magnitude > (unsigned long long)LLONG_MAX) {
+    return false;
+  }
+  ticks = negative ? -(long long)magnitude : (long long)magnitude;
+  return true;
+}
+
+
+
+
+
+
+/*   account number or order id, negative ones are rejected   */
+int decode_id (text_view text, long long& id) {
+  if (!parse_int(text.ptr, text.len, id)) {
+    return DECODE_FORMAT;
+  }
+  return id < 0 ? DECODE_ID : DECODE_OK;
+}
+
+
+
+
+
+
+/*   account number and balance of a new account, whatever they were read from   */
+int check_account (const account_command& cmd) {
+  if (cmd.account_id < 0) {
+    return DECODE_ID;
+  }
+  if (cmd.balance < 0) {
+    return DECODE_PRICE;
+  }
+  return DECODE_OK;
+}
+
+
+
+
+
+
+/*   amount and limit of an order, or id of a cancel or query   */
+int check_order (const order_command& cmd) {
+  if (cmd.type != CHILD_ORDER) {
+    return cmd.order_id < 0 ? DECODE_ID : DECODE_OK;
+  }
+  if (cmd.amount == 0 || cmd.amount == LLONG_MIN) {
+    return DECODE_AMOUNT;
+  }
+  if (cmd.price <= 0) {
+    return DECODE_PRICE;
+  }
+  return DECODE_OK;
+}
+
+
+
+
+
+
+/*   <account id="" balance=""/>   */
+int decode_account (const child_record& child, account_command& cmd) {
+  long long balance;
+
+  if (!parse_int(child.attr[0].ptr, child.attr[0].len, cmd.account_id) ||
+      !parse_price(child.attr[1].ptr, child.attr[1].len, balance)) {
+    return DECODE_FORMAT;
+  }
+  cmd.balance = balance;
+  return check_account(cmd);
+}
+
+
+
+
+
+
+/*   <account id="">NUM</account>, NUM may be negative to take shares away   */
+int decode_share (const share_record& share, share_command& cmd) {
+  if (!parse_int(share.id.ptr, share.id.len, cmd.account_id) ||
+      !parse_int(share.shares.ptr, share.shares.len, cmd.shares)) {
+    return DECODE_FORMAT;
+  }
+  return DECODE_OK;
+}
+
+
+
+
+
+
+/*   <order sym="" amount="" limit=""/>, <cancel id=""/> or <query id=""/>   */
+int decode_order (const child_record& child, long long account_id, order_command& cmd) {
+  cmd.type = child.type;
+  cmd.num = -1;
+  cmd.result = NULL;
+  cmd.account_id = account_id;
+  cmd.sym_id = -1;
+  cmd.amount = 0;
+  cmd.price = 0;
+  cmd.order_id = -1;
+
+  if (child.type != CHILD_ORDER) { // cancel or query
+    return decode_id(child.attr[0], cmd.order_id);
+  }
+  if (!parse_int(child.attr[1].ptr, child.attr[1].len, cmd.amount) ||
+      cmd.amount == LLONG_MIN ||
+      !parse_price(child.attr[2].ptr, child.attr[2].len, cmd.price)) {
+    return DECODE_FORMAT;
+  }
+  int stat = check_order(cmd);
+  if (stat != DECODE_OK) {
+    return stat;
+  }
+  decode_symbol(child.attr[0], cmd.sym_id, cmd.sym);
+  return DECODE_OK;
+}
+
+
+
+
+
+
+/*   entry of an interned symbol   */
+symbol_entry& symbol_at (int sym_id) {
+  symbol_entry* block = symbol_blocks[sym_id / SYMBOL_BLOCK].load(std::memory_order_acquire);
+  return block[sym_id % SYMBOL_BLOCK];
+}
+
+
+
+
+
+
+/*   FNV-1a hash of a symbol, straight from the request buffer   */
+std::size_t symbol_hash (text_view sym) {
+  unsigned long long hash = 14695981039346656037ULL;
+  for (long long i = 0; i < sym.len; ++i) {
+    hash = (hash ^ (unsigned char)sym.ptr[i]) * 1099511628211ULL;
+  }
+  return hash;
+}
+
+
+
+
+
+
+/*   sym_id of an interned symbol, -1 if it is not in the index   */
+// probes without a lock or a copy of the name; a slot is filled after its
+// entry, so an id seen in the index always has its name
+int find_symbol (const symbol_index* index, text_view sym) {
+  if (index == NULL) {
+    return -1;
+  }
+  for (std::size_t i = symbol_hash(sym); ; ++i) {
+    int slot = index->slots[i & index->mask].load(std::memory_order_acquire);
+    if (slot == 0) {
+      return -1;
+    }
+    const std::string* name = symbol_at(slot - 1).name;
+    if (name->size() == (std::size_t)sym.len &&
+        memcmp(name->data(), sym.ptr, sym.len) == 0) {
+      return slot - 1;
+    }
+  }
+}
+
+
+
+
+
+
+/*   put sym_id into the free slot of its name, called with symbol_mtx held   */
+void index_symbol (symbol_index* index, int sym_id) {
+  const std::string& name = *symbol_at(sym_id).name;
+  text_view sym = { name.data(), (long long)name.size() };
+  std::size_t i = symbol_hash(sym);
+  while (index->slots[i & index->mask].load(std::memory_order_relaxed) != 0) {
+    ++i;
+  }
+  index->slots[i & index->mask].store(sym_id + 1, std::memory_order_release);
+  return;
+}
+
+
+
+
+
+
+/*   empty index with room for size slots, a power of two   */
+symbol_index* new_index (std::size_t size) {
+  symbol_index* index = new symbol_index;
+  index->mask = size - 1;
+  index->slots = new std::atomic<int>[size];
+  for (std::size_t i = 0; i < size; ++i) {
+    index->slots[i].store(0, std::memory_order_relaxed);
+  }
+  return index;
+}
+
+
+
+
+
+
+/*   sym_id of a symbol which is interned already, -1 if it is not   */
+// found without locking and without copying the name, never adds a symbol
+int lookup_symbol (text_view sym) {
+  return find_symbol(symbol_lookup.load(std::memory_order_acquire), sym);
+}
+
+
+
+
+
+
+/*   small integer standing for a symbol, -1 once the table is full   */
+// only symbols stored in SYMBOL are interned (symbol_key, stored_symbol_key,
+// load_symbols), so the table grows with the market and not with the
+// symbols of rejected requests; a known symbol is found without locking,
+// only a new one takes symbol_mtx
+int intern_symbol (text_view sym) {
+  int sym_id = find_symbol(symbol_lookup.load(std::memory_order_acquire), sym);
+  if (sym_id >= 0) {
+    return sym_id;
+  }
+
+  std::lock_guard<std::mutex> lck (symbol_mtx);
+  symbol_index* index = symbol_lookup.load(std::memory_order_relaxed);
+  if ((sym_id = find_symbol(index, sym)) >= 0) { // interned meanwhile
+    return sym_id;
+  }
+  if (num_symbols == MAX_SYMBOL_BLOCKS * SYMBOL_BLOCK) {
+    return -1;
+  }
+  sym_id = num_symbols;
+  if (sym_id % SYMBOL_BLOCK == 0) {
+    symbol_entry* block = new symbol_entry[SYMBOL_BLOCK];
+    for (int i = 0; i < SYMBOL_BLOCK; ++i) {
+      block[i].name = NULL;
+      block[i].key.store(NO_SYMBOL_KEY, std::memory_order_relaxed);
+    }
+    symbol_blocks[sym_id / SYMBOL_BLOCK].store(block, std::memory_order_release);
+  }
+  symbol_at(sym_id).name = new std::string(sym.ptr, sym.len);
+  ++num_symbols;
+
+  if (index == NULL || (std::size_t)num_symbols * 2 > index->mask + 1) {
+    symbol_index* larger = new_index(index == NULL ? SYMBOL_BLOCK : (index->mask + 1) * 2);
+    for (int i = 0; i < num_symbols; ++i) {
+      index_symbol(larger, i);
+    }
+    symbol_lookup.store(larger, std::memory_order_release);
+  }
+  else {
+    index_symbol(index, sym_id);
+  }
+  return sym_id;
+}
+
+
+
+
+
+
+/*   symbol of a request, its sym_id if interned or else its text   */
+// the text is only copied for a symbol which is not in the market yet, it
+// is interned when the operation stores it
+void decode_symbol (text_view text, int& sym_id, std::string& sym) {
+  sym_id = lookup_symbol(text);
+  if (sym_id < 0) {
+    sym = view_str(text);
+  }
+  return;
+}
+
+
+
+
+
+
+/*   name of an interned symbol   */
+// the id was handed out after its name was set, before the caller could see it
+const std::string& symbol_name (int sym_id) {
+  return *symbol_at(sym_id).name;
+}
+
+
+
+
+
+
+
+/*   SYM_ID of an interned symbol, NO_SYMBOL_KEY if it is not known yet   */
+// read without a lock by every order, a key never changes once stored
+long long catalog_key (int sym_id) {
+  return symbol_at(sym_id).key.load(std::memory_order_acquire);
+}
+
+
+
+
+
+
+/*   remember the SYM_ID of an interned symbol   */
+// only keys committed to SYMBOL are stored, a rolled back one would be lost
+void catalog_put (int sym_id, long long key) {
+  symbol_at(sym_id).key.store(key, std::memory_order_release);
+  return;
+}
+
+
+
+
+
+
+/*   NUMERIC column value in ticks   */
+// throws like std::stold when the value is not a number
+long long price_ticks (const std::string& text) {
+  long long ticks;
+  if (!parse_price(text.data(), text.length(), ticks)) {
+    throw std::invalid_argument("price_ticks: " + text);
+  }
+  return ticks;
+}
+
+
+
+
+
+
+/*   write the decimal digits of value backwards, ending before end   */
+// returns where they start, buf of MAX_NUMBER_TEXT bytes holds any value
+char* format_digits (char* end, unsigned long long value) {
+  do {
+    *--end = (char)('0' + value % 10);
+    value /= 10;
+  } while (value != 0);
+  return end;
+}
+
+
+
+
+
+
+/*   append value in decimal   */
+// formatted on the stack, the only allocation is growing out
+void append_int (std::string* out, long long value) {
+  char buf[MAX_NUMBER_TEXT];
+  char* end = buf + MAX_NUMBER_TEXT;
+  unsigned long long magnitude = value < 0 ? -(unsigned long long)value : value;
+  char* start = format_digits(end, magnitude);
+
+  if (value < 0) {
+    *--start = '-';
+  }
+  out->append(start, end - start);
+  return;
+}
+
+
+
+
+
+
+/*   append ticks as a decimal number without trailing zeros: 12, 12.5 or 12.05   */
+void append_price (std::string* out, long long ticks) {
+  char buf[MAX_NUMBER_TEXT];
+  char* end = buf + MAX_NUMBER_TEXT;
+  unsigned long long magnitude = ticks < 0 ? -(unsigned long long)ticks : ticks;
+  unsigned long long frac = magnitude % PRICE_SCALE;
+  char* start = end;
+
+  if (frac != 0) {
+    if (frac % 10 != 0) {
+      *--start = (char)('0' + frac % 10);
+    }
+    *--start = (char)('0' + frac / 10);
+    *--start = '.';
+  }
+  start = format_digits(start, magnitude / PRICE_SCALE);
+  if (ticks < 0) {
+    *--start = '-';
+  }
+  out->append(start, end - start);
+  return;
+}
+
+
+
+
+
+
+/*   ticks as a decimal number without trailing zeros: 12, 12.5 or 12.05   */
+std::string format_price (long long ticks) {
+  std::string str;
+  append_price(&str, ticks);
+  return str;
+}
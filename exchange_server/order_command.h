@@ -0,0 +1,102 @@
+#ifndef ORDER_COMMAND_H
+#define ORDER_COMMAND_H
+
+#include <string>
+#include <vector>
+
+#include "request_parser.h"
+
+#define PRICE_SCALE     100     // ticks per unit, prices and balances are NUMERIC(20,2)
+#define SYMBOL_BLOCK    1024    // symbols interned per block of the symbol table
+#define MAX_SYMBOL_BLOCKS 65536 // blocks the table of stored symbols grows to at most
+#define NO_SYMBOL_KEY   0       // not in the catalog yet, SYM_ID starts at 1
+#define MAX_NUMBER_TEXT 24      // sign, 20 digits of a 64 bit number and a fraction
+
+// result of decoding one child element
+#define DECODE_OK       0
+#define DECODE_FORMAT   1       // a field is not a number
+#define DECODE_ID       2       // negative account number or order id
+#define DECODE_AMOUNT   3       // order amount is 0
+#define DECODE_PRICE    4       // limit <= 0 or balance < 0
+#define DECODE_SYMBOL   5       // symbol of a binary record is empty
+
+struct op_result;
+
+
+
+/*   <account id="" balance=""/> of a <create>   */
+struct account_command {
+  long long account_id;
+  long long balance;          // in ticks
+};
+
+
+
+/*   <account id="">NUM</account> inside a <symbol>   */
+struct share_command {
+  long long account_id;
+  long long shares;
+};
+
+
+
+/*   child of a <create>   */
+struct create_command {
+  int type;                   // CHILD_ACCOUNT or CHILD_SYMBOL
+  op_result* result;          // slot of the request the outcome goes into
+  account_command account;    // CHILD_ACCOUNT only
+  int sym_id;                 // CHILD_SYMBOL only: interned symbol, -1 if new
+  std::string sym;            // CHILD_SYMBOL only: the symbol while sym_id is -1
+  std::vector <share_command> shares;
+};
+
+
+
+/*   <order>, <cancel> or <query> of a <transactions>   */
+struct order_command {
+  int type;                   // CHILD_ORDER, CHILD_CANCEL or CHILD_QUERY
+  long long num;              // position in the request
+  op_result* result;          // slot of the request the outcome goes into
+  long long account_id;
+  int sym_id;                 // <order> only: interned symbol, -1 if new
+  std::string sym;            // <order> only: the symbol while sym_id is -1
+  long long amount;           // <order> only: shares, negative to sell
+  long long price;            // <order> only: limit in ticks
+  long long order_id;         // <cancel> and <query> only
+};
+
+
+
+int decode_id (text_view text, long long& id);
+
+int check_account (const account_command& cmd);
+
+int check_order (const order_command& cmd);
+
+int decode_account (const child_record& child, account_command& cmd);
+
+int decode_share (const share_record& share, share_command& cmd);
+
+int decode_order (const child_record& child, long long account_id, order_command& cmd);
+
+int lookup_symbol (text_view sym);
+
+int intern_symbol (text_view sym);
+
+void decode_symbol (text_view text, int& sym_id, std::string& sym);
+
+const std::string& symbol_name (int sym_id);
+
+long long catalog_key (int sym_id);
+
+void catalog_put (int sym_id, long long key);
+
+long long price_ticks (const std::string& text);
+
+std::string format_price (long long ticks);
+
+void append_int (std::string* out, long long value);
+
+void append_price (std::string* out, long long ticks);
+
+#endif
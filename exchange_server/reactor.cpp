@@ -0,0 +1,792 @@
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include <stdint.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <string.h>
+
+// network libraries
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <netinet/in.h>
+
+// boost library for thread pool
+#include <boost/bind.hpp>
+#include <boost/asio.hpp>
+#include <boost/asio/thread_pool.hpp>
+
+#include "operations.h"
+#include "buffer_pool.h"
+#include "frame_decoder.h"
+#include "response.h"
+#include "binary_protocol.h"
+#include "reactor.h"
+
+#define DEBUG           0
+#define MAX_EVENTS      256
+#define LISTEN_ID       0
+#define WAKE_ID         1
+#define UNIX_LISTEN_ID  2
+#define FIRST_CONN_ID   16
+
+
+
+/*   set O_NONBLOCK on a file descriptor   */
+int set_nonblocking (int fd) {
+  int flags = fcntl(fd, F_GETFL, 0);
+  if (flags < 0) {
+    return -1;
+  }
+  return fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+}
+
+
+
+
+
+
+/*   set the depth of the admission queue and clear its counters   */
+void admission_init (admission& adm, long long max_depth) {
+  adm.max_depth = max_depth;
+  adm.depth = 0;
+  adm.admitted = 0;
+  adm.rejected = 0;
+  return;
+}
+
+
+
+
+
+
+/*   take a place in the admission queue, false if it is full   */
+bool admit_request (admission& adm) {
+  if (adm.depth.fetch_add(1) >= adm.max_depth) {
+    adm.depth.fetch_sub(1);
+    adm.rejected.fetch_add(1);
+    return false;
+  }
+  adm.admitted.fetch_add(1);
+  return true;
+}
+
+
+
+
+
+
+/*   give the place back once the request has been executed   */
+void finish_request (admission& adm) {
+  adm.depth.fetch_sub(1);
+  return;
+}
+
+
+
+
+
+
+/*   hand a response or a chunk of one to the event loop and wake it up   */
+void post_done (reactor* r, const task_result& res) {
+  {
+    std::lock_guard<std::mutex> lck (r->done_mtx);
+    r->done.push_back(res);
+  }
+  uint64_t one = 1;
+  if (write(r->wake_fd, &one, sizeof(one)) < 0) {
+    perror("reactor wake");
+  }
+  return;
+}
+
+
+
+
+
+
+/*   queue the response of a request for the event loop and wake it up   */
+void complete_task (reactor* r, long long conn_id, long long tag, std::string* response) {
+  task_result res = { conn_id, tag, response, false };
+  post_done(r, res);
+  finish_request(*r->adm);
+  return;
+}
+
+
+
+
+
+
+/*   queue the results of a request which are done, the request goes on   */
+// chunk_fn of the sinks of chunked connections
+void send_chunk (result_sink* sink, std::string* chunk) {
+  task_result res = { sink->conn_id, sink->tag, chunk, true };
+  post_done((reactor*)sink->owner, res);
+  return;
+}
+
+
+
+
+
+
+/*   execute one framed request in the thread pool and hand the response back   */
+void execute_task (reactor* r, long long request_id, long long conn_id,
+                   long long tag, bool binary, bool chunked, slab* buffer) {
+  long long start_time = get_clock_time();
+  long long end_time;
+  std::string* response = new std::string;
+  result_sink sink = { send_chunk, r, conn_id, tag, 0 };
+
+  std::cout << "request_id: " << request_id << ", conn_id: "
+            << conn_id << "\n" << std::endl;
+  try {
+    if (binary) {
+      execute_binary(buffer->data, buffer->len, response);
+    }
+    else {
+      execute_request(buffer->data, buffer->len, response, chunked ? &sink : NULL);
+    }
+  }
+  catch (std::exception& e) {
+#if DEBUG
+    std::cerr << "execute_task: " << e.what() << std::endl;
+#endif
+  }
+  slab_put(buffer);
+  complete_task(r, conn_id, tag, response);
+  end_time = get_clock_time();
+  std::cout << "execution time of the task: " << end_time - start_time << std::endl;
+  return;
+}
+
+
+
+
+
+
+/*   release everything owned by a connection   */
+void free_conn (conn_state* c) {
+  frame_free(c->dec);
+  for (std::size_t i = 0; i < c->ready.size(); ++i) {
+    slab_put(c->ready[i].buf);
+  }
+  for (std::size_t i = 0; i < c->out_queue.size(); ++i) {
+    delete c->out_queue[i].response;
+  }
+  delete c;
+  return;
+}
+
+
+
+
+
+
+/*   remove connection from the reactor and close its socket   */
+void close_conn (reactor& r, conn_state* c) {
+  if (c->stream != NULL) { // the rest of the request will not come
+    stream_end(r, c, NULL);
+  }
+  r.conns.erase(c->conn_id);
+  shm_detach(r, c);
+#if IO_URING
+  if (r.uring != NULL) {
+    uring_close(r, c);
+    return;
+  }
+#endif
+  epoll_ctl(r.epoll_fd, EPOLL_CTL_DEL, c->fd, NULL);
+  close(c->fd);
+  free_conn(c);
+  return;
+}
+
+
+
+
+
+
+/*   whether the client opened with BINARY_PREFACE and is answered in binary   */
+bool conn_binary (conn_state* c) {
+  return c->dec.preface == PREFACE_BINARY;
+}
+
+
+
+
+
+
+/*   whether the client opened with CHUNKED_PREFACE and gets responses in chunks   */
+bool conn_chunked (conn_state* c) {
+  return c->dec.preface == PREFACE_CHUNKED;
+}
+
+
+
+
+
+
+/*   take over a response body, it is sent along with its length line   */
+// on a chunked connection every part of a response has its own length line
+// and the last one is followed by CHUNK_END
+void set_response (conn_state* c, const task_result& res) {
+  c->out_buf.swap(*res.response);
+  c->out_more = res.more;
+  if (conn_chunked(c)) {
+    c->out_head_len = chunk_head(c->out_buf, c->out_first, c->out_head);
+    c->out_parts = (c->out_first ? SEND_PROLOG : 0) | (res.more ? 0 : SEND_CHUNK_END);
+    c->out_first = !res.more;
+  }
+  else {
+    c->out_head_len = response_head(c->out_buf, res.tag, conn_binary(c), c->out_head);
+    c->out_parts = conn_binary(c) ? 0 : SEND_PROLOG;
+  }
+  c->out_off = 0;
+  return;
+}
+
+
+
+
+
+
+/*   queue a response or chunk, it is sent as soon as the previous one is out   */
+// returns -1 if the connection has been closed
+int queue_response (reactor& r, conn_state* c, const task_result& res) {
+  c->out_queue.push_back(res);
+  if (c->out_head_len != 0) {
+    return 0; // another response is being sent
+  }
+  task_result next = c->out_queue.front();
+  c->out_queue.pop_front();
+  set_response(c, next);
+  delete next.response;
+  return flush_conn(r, c);
+}
+
+
+
+
+
+
+/*   queue a finished response, it is sent as soon as the previous one is out   */
+// returns -1 if the connection has been closed
+int respond_conn (reactor& r, conn_state* c, long long tag, std::string* body) {
+  task_result res = { c->conn_id, tag, body, false };
+  return queue_response(r, c, res);
+}
+
+
+
+
+
+
+/*   hand a complete request to the thread pool   */
+// returns -1 if the connection has been closed
+int dispatch_conn (reactor& r, conn_state* c, ready_frame frame) {
+  if (!admit_request(*r.adm)) {
+    // shed load instead of letting every queued request wait longer
+    slab_put(frame.buf);
+    if (conn_binary(c)) {
+      return respond_conn(r, c, frame.tag, binary_status(BIN_BUSY));
+    }
+    return respond_conn(r, c, frame.tag, new std::string(
+      "<results>\n  <error>server busy</error>\n</results>\n"));
+  }
+  ++c->inflight;
+  boost::asio::post(*r.handler, boost::bind(execute_task, &r, r.next_request_id,
+                                            c->conn_id, frame.tag, conn_binary(c),
+                                            conn_chunked(c), frame.buf));
+  ++r.next_request_id;
+  return 0;
+}
+
+
+
+
+
+
+/*   answer with an error and close the connection once it is sent   */
+// returns -1 if the connection has been closed
+int reject_conn (reactor& r, conn_state* c) {
+#if DEBUG
+  std::cerr << "invalid request" << std::endl;
+#endif
+  c->busy = true;
+  c->closing = true;
+  if (conn_binary(c)) {
+    return respond_conn(r, c, NO_TAG, binary_status(BIN_INVALID));
+  }
+  return respond_conn(r, c, NO_TAG, new std::string(
+    "<result>\n  <error>Invalid XML request</error>\n</result>\n"));
+}
+
+
+
+
+
+
+/*   look at the buffered bytes and start the requests which are complete   */
+// returns -1 if the connection has been closed
+int process_conn (reactor& r, conn_state* c) {
+  if (c->stream != NULL && c->peer_closed) {
+    // the client is done sending, execute what has been received
+    stream_end(r, c, frame_take(c->dec));
+  }
+  if (c->busy) {
+    return 0; // responses go out in order, one request at a time
+  }
+  if (c->dec.preface == PREFACE_SHM_RING && c->dec.persistent && c->shm == NULL) {
+    return shm_attach(r, c); // requests follow in shared memory
+  }
+  while (!c->ready.empty() && !c->busy && !c->closing) { // done receiving request
+    ready_frame frame = c->ready.front();
+    c->ready.pop_front();
+    c->ready_bytes -= frame.buf->len;
+    // pipelined requests run side by side and are answered as they finish
+    c->busy = !frame_tagged(c->dec);
+    if (dispatch_conn(r, c, frame) < 0) {
+      return -1;
+    }
+  }
+  if (c->busy || c->closing) {
+    return 0;
+  }
+  if (frame_status(c->dec) == FRAME_ERROR) {
+    // wrong format, answer without bothering the workers
+    return reject_conn(r, c);
+  }
+  if (c->peer_closed) {
+    if (c->dec.len != 0 && !c->dec.persistent) {
+      // one-shot clients may close early, execute what has been received
+      ready_frame frame = { frame_take(c->dec), NO_TAG };
+      c->busy = true;
+      return dispatch_conn(r, c, frame);
+    }
+    if (c->inflight == 0 && c->out_head_len == 0) {
+      close_conn(r, c); // nothing (complete) left to answer
+      return -1;
+    }
+  }
+  return 0;
+}
+
+
+
+
+
+
+/*   the whole response has been sent, close or go on with the next request   */
+// returns -1 if the connection has been closed
+int sent_conn (reactor& r, conn_state* c) {
+  c->out_buf.clear();
+  c->out_head_len = 0;
+  c->out_off = 0;
+  if (!c->out_queue.empty()) { // pipelined response which finished meanwhile
+    task_result res = c->out_queue.front();
+    c->out_queue.pop_front();
+    set_response(c, res);
+    delete res.response;
+    return flush_conn(r, c);
+  }
+  if (c->out_more) {
+    return 0; // the rest of the response is still being executed
+  }
+  if (!c->dec.persistent || c->closing) { // one request per connection, done
+    if (c->inflight != 0) {
+      return 0; // closed after the last pipelined response
+    }
+    close_conn(r, c);
+    return -1;
+  }
+
+  // response sent, go on with the next request of this client
+  c->busy = false;
+  if (c->read_paused) {
+    return read_conn(r, c);
+  }
+  return process_conn(r, c);
+
+}
+
+
+
+
+
+
+/*   send as much of the pending response as the socket accepts   */
+// returns -1 if the connection has been closed
+int flush_conn (reactor& r, conn_state* c) {
+  struct iovec iov[RESPONSE_IOV];
+  int n = response_iov(c->out_head, c->out_head_len, c->out_buf, c->out_off,
+                       c->out_parts, iov);
+
+  if (n == 0) {
+    return 0; // nothing is pending
+  }
+  if (c->shm != NULL) {
+    return shm_write(r, c);
+  }
+#if IO_URING
+  if (r.uring != NULL) {
+    return uring_send(r, c);
+  }
+#endif
+  while (n > 0) {
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = iov;
+    msg.msg_iovlen = n;
+    ssize_t len = sendmsg(c->fd, &msg, MSG_NOSIGNAL);
+    if (len < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      if (errno == EAGAIN || errno == EWOULDBLOCK) {
+        return 0; // wait for EPOLLOUT
+      }
+      perror("response send");
+      close_conn(r, c);
+      return -1;
+    }
+    c->out_off += len; // a short send continues inside the fragment it stopped in
+    n = response_iov(c->out_head, c->out_head_len, c->out_buf, c->out_off,
+                     c->out_parts, iov);
+  }
+  return sent_conn(r, c);
+}
+
+
+
+
+
+
+/*   move every request completed by the last received bytes to the queue   */
+// the rest of a frame still being received may start executing already
+void queue_frames (reactor& r, conn_state* c, int stat) {
+  while (stat == FRAME_DONE) {
+    ready_frame frame;
+    frame.tag = frame_tagged(c->dec) ? c->dec.tag : NO_TAG;
+    frame.buf = frame_take(c->dec);
+    if (c->stream != NULL) { // its children are being executed already
+      stream_end(r, c, frame.buf);
+    }
+    else {
+      c->ready_bytes += frame.buf->len;
+      c->ready.push_back(frame);
+    }
+    stat = frame_status(c->dec);
+  }
+#if STREAM_REQUESTS
+  stream_feed(r, c);
+#endif
+  return;
+}
+
+
+
+
+
+
+/*   whether more bytes should be read from this client now   */
+bool want_read (conn_state* c) {
+  if (c->shm != NULL) {
+    return false; // requests come through the ring, see shm_read
+  }
+  if (!c->dec.persistent && c->stream == NULL && (c->busy || !c->ready.empty())) {
+    return false; // request already taken, nothing more is read from this client
+  }
+  if (frame_status(c->dec) == FRAME_ERROR) {
+    return false; // stream is out of sync, nothing after this is a request
+  }
+  return true;
+}
+
+
+
+
+
+
+/*   read everything available on the socket and dispatch a complete request   */
+// returns -1 if the connection has been closed
+int read_conn (reactor& r, conn_state* c) {
+  c->read_paused = false;
+  if (c->shm != NULL) {
+    return shm_read(r, c);
+  }
+#if IO_URING
+  if (r.uring != NULL) {
+    return uring_recv(r, c);
+  }
+#endif
+  while (want_read(c)) {
+    if (c->ready_bytes >= MAX_PENDING) {
+      c->read_paused = true; // resumed once the queued requests are answered
+      break;
+    }
+    // receive straight into the frame being assembled
+    long long space;
+    char* data = frame_space(c->dec, &space);
+    ssize_t len = recv(c->fd, data, space, 0);
+    if (len < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      if (errno == EAGAIN || errno == EWOULDBLOCK) {
+        break; // socket drained
+      }
+      perror("request recv");
+      close_conn(r, c);
+      return -1;
+    }
+    if (len == 0) { // connection is closed by the client
+      c->peer_closed = true;
+      break;
+    }
+    queue_frames(r, c, frame_commit(c->dec, len));
+  }
+  return process_conn(r, c);
+}
+
+
+
+
+
+
+/*   accept every pending connection on a listening socket   */
+void accept_conns (reactor& r, int listen_fd, bool local) {
+  while (1) {
+    struct sockaddr_storage client_addr;
+    socklen_t addr_len = sizeof(client_addr);
+    int client_conn_sfd = accept4(listen_fd, (struct sockaddr*)&client_addr,
+                                  &addr_len, SOCK_NONBLOCK | SOCK_CLOEXEC);
+    if (client_conn_sfd < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      if (errno != EAGAIN && errno != EWOULDBLOCK) {
+        perror("Cannot accept connection");
+      }
+      return;
+    }
+
+    add_conn(r, client_conn_sfd, local);
+  }
+}
+
+
+
+
+
+
+/*   start serving an accepted client socket   */
+conn_state* add_conn (reactor& r, int client_conn_sfd, bool local) {
+  conn_state* c = new conn_state;
+  c->conn_id = r.next_conn_id++;
+  c->fd = client_conn_sfd;
+  frame_init(c->dec);
+  c->ready_bytes = 0;
+  c->inflight = 0;
+  c->out_head_len = 0;
+  c->out_parts = 0;
+  c->out_more = false;
+  c->out_first = true;
+  c->out_off = 0;
+  c->busy = false;
+  c->closing = false;
+  c->peer_closed = false;
+  c->read_paused = false;
+  c->send_inflight = false;
+  c->recv_armed = false;
+  c->local = local;
+  c->stream = NULL;
+  c->shm = NULL;
+  c->shm_req_fd = -1;
+  c->shm_resp_fd = -1;
+
+  if (r.uring == NULL) {
+    struct epoll_event ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+    ev.data.u64 = c->conn_id;
+    if (epoll_ctl(r.epoll_fd, EPOLL_CTL_ADD, client_conn_sfd, &ev) < 0) {
+      perror("epoll_ctl client");
+      close(client_conn_sfd);
+      free_conn(c);
+      return NULL;
+    }
+  }
+  r.conns[c->conn_id] = c;
+  return c;
+}
+
+
+
+
+
+
+/*   move finished responses from the workers onto their connections   */
+void collect_done (reactor& r) {
+  std::vector <task_result> done;
+  uint64_t count;
+
+  // reset the eventfd counter, it is edge-triggered
+  // (the io_uring backend has already read it)
+  while (r.uring == NULL && read(r.wake_fd, &count, sizeof(count)) > 0) {
+  }
+  {
+    std::lock_guard<std::mutex> lck (r.done_mtx);
+    done.swap(r.done);
+  }
+  for (std::size_t i = 0; i < done.size(); ++i) {
+    std::unordered_map <long long, conn_state*>::iterator it =
+      r.conns.find(done[i].conn_id);
+    if (it == r.conns.end()) { // client went away while executing
+      delete done[i].response;
+      continue;
+    }
+    conn_state* c = it->second;
+    if (!done[i].more) {
+      --c->inflight;
+    }
+    queue_response(r, c, done[i]);
+  }
+  return;
+}
+
+
+
+
+
+
+/*   set up the io_uring backend if possible, otherwise the epoll instance   */
+int reactor_init (reactor& r, int listen_fd, int unix_fd,
+                  boost::asio::thread_pool* handler, admission* adm) {
+  struct epoll_event ev;
+
+  r.listen_fd = listen_fd;
+  r.unix_fd = unix_fd;
+  r.handler = handler;
+  r.adm = adm;
+  r.next_conn_id = FIRST_CONN_ID;
+  r.next_request_id = 0;
+  r.epoll_fd = -1;
+  r.uring = NULL;
+
+  if (set_nonblocking(listen_fd) < 0) {
+    perror("Cannot set listening socket non-blocking");
+    return -1;
+  }
+  if (unix_fd >= 0 && set_nonblocking(unix_fd) < 0) {
+    perror("Cannot set unix-domain socket non-blocking");
+    return -1;
+  }
+  r.wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  if (r.wake_fd < 0) {
+    perror("Cannot create eventfd");
+    return -1;
+  }
+#if IO_URING
+  if (uring_init(r) == 0) {
+    return 0;
+  }
+  std::cerr << "io_uring is not available, falling back to epoll" << std::endl;
+#endif
+
+  r.epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+  if (r.epoll_fd < 0) {
+    perror("Cannot create epoll instance");
+    return -1;
+  }
+
+  memset(&ev, 0, sizeof(ev));
+  ev.events = EPOLLIN | EPOLLET;
+  ev.data.u64 = LISTEN_ID;
+  if (epoll_ctl(r.epoll_fd, EPOLL_CTL_ADD, listen_fd, &ev) < 0) {
+    perror("epoll_ctl listen");
+    return -1;
+  }
+  ev.events = EPOLLIN | EPOLLET;
+  ev.data.u64 = UNIX_LISTEN_ID;
+  if (unix_fd >= 0 && epoll_ctl(r.epoll_fd, EPOLL_CTL_ADD, unix_fd, &ev) < 0) {
+    perror("epoll_ctl unix listen");
+    return -1;
+  }
+  ev.events = EPOLLIN | EPOLLET;
+  ev.data.u64 = WAKE_ID;
+  if (epoll_ctl(r.epoll_fd, EPOLL_CTL_ADD, r.wake_fd, &ev) < 0) {
+    perror("epoll_ctl eventfd");
+    return -1;
+  }
+  return 0;
+}
+
+
+
+
+
+
+/*   event loop: accept, read, dispatch complete requests and write responses   */
+void reactor_run (reactor& r) {
+  struct epoll_event events[MAX_EVENTS];
+
+#if IO_URING
+  if (r.uring != NULL) {
+    uring_run(r);
+    return;
+  }
+#endif
+  while (1) {
+    int n = epoll_wait(r.epoll_fd, events, MAX_EVENTS, -1);
+    if (n < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      perror("epoll_wait");
+      return;
+    }
+    for (int i = 0; i < n; ++i) {
+      long long id = events[i].data.u64;
+      if (id == LISTEN_ID) {
+        accept_conns(r, r.listen_fd, false);
+        continue;
+      }
+      if (id == UNIX_LISTEN_ID) {
+        accept_conns(r, r.unix_fd, true);
+        continue;
+      }
+      if (id == WAKE_ID) {
+        collect_done(r);
+        continue;
+      }
+
+      std::unordered_map <long long, conn_state*>::iterator it =
+        r.conns.find(id & ~SHM_ID_BIT);
+      if (it == r.conns.end()) {
+        continue; // closed earlier in this round
+      }
+      conn_state* c = it->second;
+      if (id & SHM_ID_BIT) { // the client has moved one of its rings
+        read_conn(r, c);
+        continue;
+      }
+      if (events[i].events & EPOLLERR) {
+        close_conn(r, c);
+        continue;
+      }
+      if (events[i].events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP)) {
+        if (read_conn(r, c) < 0) {
+          continue;
+        }
+      }
+      if (events[i].events & EPOLLOUT) {
+        flush_conn(r, c);
+      }
+    }
+  }
+}
@@ -0,0 +1,198 @@
+#ifndef REACTOR_H
+#define REACTOR_H
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <utility>
+#include <unordered_map>
+#include <mutex>
+#include <atomic>
+
+// boost library for thread pool
+#include <boost/asio/thread_pool.hpp>
+
+#include <sys/uio.h>
+#include <sys/socket.h>
+
+#include "frame_decoder.h"
+#include "response.h"
+#include "result.h"
+
+// io_uring backend needs kernel headers of linux 5.19 or later,
+// build with -DIO_URING=1 to enable it
+#ifndef IO_URING
+#define IO_URING        0
+#endif
+
+// stop reading a persistent connection with this many bytes of queued requests
+#define MAX_PENDING     409600
+
+// start executing the children of a <transactions> before all of it has arrived,
+// only on chunked connections, which opt in to results of a partly valid request
+#define STREAM_REQUESTS 1
+
+// epoll id of the request eventfd of a shared-memory client, next to its conn_id
+#define SHM_ID_BIT      (1LL << 62)
+
+
+
+/*   complete request waiting to be executed   */
+struct ready_frame {
+  slab* buf;
+  long long tag;              // correlation tag, NO_TAG unless pipelined
+};
+
+
+
+/*   response finished by a worker   */
+struct task_result {
+  long long conn_id;
+  long long tag;
+  std::string* response;
+  bool more;                  // chunk of a response still being executed
+};
+
+
+
+/*   state of one client connection owned by the reactor   */
+struct conn_state {
+  long long conn_id;          // unique id, fd numbers are reused by the kernel
+  int fd;
+  frame_decoder dec;          // splits the received bytes into requests
+  std::deque <ready_frame> ready;  // complete requests not yet executed
+  long long ready_bytes;      // total size of the queued requests
+  int inflight;               // requests being executed in the thread pool
+  std::deque <task_result> out_queue;  // finished while another response is sent
+  std::string out_buf;        // body of the response waiting to be sent
+  char out_head[RESPONSE_HEAD_SIZE];  // its length line
+  int out_head_len;           // 0 when no response is pending
+  int out_parts;              // SEND_* sent around out_buf
+  bool out_more;              // out_buf is a chunk, more of the response follows
+  bool out_first;             // chunked: the next chunk starts a response
+  std::size_t out_off;        // bytes of the whole response already sent
+  bool busy;                  // not pipelined: a request is executed or answered
+  bool closing;               // close once out_buf has been sent
+  bool peer_closed;           // client has shut down its sending side
+  bool read_paused;           // too much buffered, stopped reading the socket
+  bool send_inflight;         // io_uring backend: kernel still owns out_buf
+  bool recv_armed;            // io_uring backend: a recv is submitted
+  struct iovec out_iov[RESPONSE_IOV];  // io_uring backend: the send in flight
+  struct msghdr out_msg;
+  bool local;                 // accepted on the unix-domain socket
+  struct request_stream* stream;  // request executed while it is received, or NULL
+  struct shm_region* shm;     // shared-memory rings, NULL for plain sockets
+  int shm_req_fd;             // eventfd written by the client
+  int shm_resp_fd;            // eventfd written by the server
+};
+
+
+
+/*   bounded admission in front of the thread pool, shared by every reactor   */
+// requests beyond max_depth are answered with "server busy" right away
+struct admission {
+  long long max_depth;
+  std::atomic <long long> depth;      // posted to the thread pool, not yet finished
+  std::atomic <long long> admitted;
+  std::atomic <long long> rejected;
+};
+
+
+
+/*   edge-triggered epoll event loop which owns every client socket   */
+struct reactor {
+  int epoll_fd;               // -1 when the io_uring backend is in use
+  struct uring_state* uring;  // NULL when the epoll backend is in use
+  int listen_fd;
+  int unix_fd;                // -1 when there is no unix-domain listener
+  int wake_fd;                // eventfd written by workers when a response is ready
+  long long next_conn_id;
+  long long next_request_id;
+  boost::asio::thread_pool* handler;
+  admission* adm;
+  std::unordered_map <long long, conn_state*> conns;
+
+  // responses finished by the workers, collected by the event loop
+  std::mutex done_mtx;
+  std::vector <task_result> done;
+};
+
+
+
+int reactor_init (reactor& r, int listen_fd, int unix_fd,
+                  boost::asio::thread_pool* handler, admission* adm);
+
+void reactor_run (reactor& r);
+
+void admission_init (admission& adm, long long max_depth);
+
+bool admit_request (admission& adm);
+
+void finish_request (admission& adm);
+
+// connection handling shared by the epoll and io_uring backends
+conn_state* add_conn (reactor& r, int client_conn_sfd, bool local);
+
+void free_conn (conn_state* c);
+
+void close_conn (reactor& r, conn_state* c);
+
+int reject_conn (reactor& r, conn_state* c);
+
+bool conn_binary (conn_state* c);
+
+bool conn_chunked (conn_state* c);
+
+void set_response (conn_state* c, const task_result& res);
+
+int respond_conn (reactor& r, conn_state* c, long long tag, std::string* body);
+
+int process_conn (reactor& r, conn_state* c);
+
+int read_conn (reactor& r, conn_state* c);
+
+int flush_conn (reactor& r, conn_state* c);
+
+int sent_conn (reactor& r, conn_state* c);
+
+void queue_frames (reactor& r, conn_state* c, int stat);
+
+bool want_read (conn_state* c);
+
+void collect_done (reactor& r);
+
+void complete_task (reactor* r, long long conn_id, long long tag, std::string* response);
+
+void send_chunk (result_sink* sink, std::string* chunk);
+
+// <transactions> whose children are executed while the rest is received
+void stream_feed (reactor& r, conn_state* c);
+
+void stream_end (reactor& r, conn_state* c, slab* frame);
+
+// shared-memory ring transport of unix-domain clients
+int shm_attach (reactor& r, conn_state* c);
+
+int shm_read (reactor& r, conn_state* c);
+
+int shm_write (reactor& r, conn_state* c);
+
+void shm_detach (reactor& r, conn_state* c);
+
+#if IO_URING
+int uring_init (reactor& r);
+
+void uring_run (reactor& r);
+
+int uring_recv (reactor& r, conn_state* c);
+
+int uring_send (reactor& r, conn_state* c);
+
+void uring_close (reactor& r, conn_state* c);
+
+void uring_poll_shm (reactor& r, conn_state* c);
+
+void uring_cancel_shm (reactor& r, conn_state* c);
+#endif
+
+#endif
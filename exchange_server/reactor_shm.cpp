@@ -0,0 +1,271 @@
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include <stdint.h>
+#include <errno.h>
+#include <unistd.h>
+#include <string.h>
+
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/syscall.h>
+
+#include "frame_decoder.h"
+#include "shm_ring.h"
+#include "response.h"
+#include "reactor.h"
+
+#ifndef MFD_CLOEXEC
+#define MFD_CLOEXEC     1U
+#endif
+
+
+
+/*   tell the client that the rings have moved   */
+void shm_wake (conn_state* c) {
+  uint64_t one = 1;
+  if (write(c->shm_resp_fd, &one, sizeof(one)) < 0 && errno != EAGAIN) {
+    perror("shm wake");
+  }
+  return;
+}
+
+
+
+
+
+
+/*   pass the shared memory and both eventfds to the client   */
+int shm_send_fds (conn_state* c, int mem_fd) {
+  int fds[3] = { mem_fd, c->shm_req_fd, c->shm_resp_fd };
+  char ctrl[CMSG_SPACE(sizeof(fds))];
+  struct msghdr msg;
+  struct iovec iov;
+
+  memset(&msg, 0, sizeof(msg));
+  memset(ctrl, 0, sizeof(ctrl));
+  // the preface is echoed as the handshake answer
+  iov.iov_base = (void*)SHM_RING_PREFACE;
+  iov.iov_len = sizeof(SHM_RING_PREFACE) - 1;
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = ctrl;
+  msg.msg_controllen = sizeof(ctrl);
+  struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+  cmsg->cmsg_level = SOL_SOCKET;
+  cmsg->cmsg_type = SCM_RIGHTS;
+  cmsg->cmsg_len = CMSG_LEN(sizeof(fds));
+  memcpy(CMSG_DATA(cmsg), fds, sizeof(fds));
+  while (sendmsg(c->fd, &msg, MSG_NOSIGNAL) < 0) {
+    if (errno != EINTR) {
+      return -1;
+    }
+  }
+  return 0;
+}
+
+
+
+
+
+
+/*   answer the "shm-ring\n" preface with a pair of rings in shared memory   */
+// returns -1 if the connection has been closed
+int shm_attach (reactor& r, conn_state* c) {
+  int mem_fd = -1;
+  void* mem = MAP_FAILED;
+
+  if (!c->local) { // descriptors can only be passed on a unix-domain socket
+    return reject_conn(r, c);
+  }
+  c->shm_req_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  c->shm_resp_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  mem_fd = syscall(__NR_memfd_create, "exchange_shm_ring", MFD_CLOEXEC);
+  if (c->shm_req_fd < 0 || c->shm_resp_fd < 0 || mem_fd < 0 ||
+      ftruncate(mem_fd, sizeof(shm_region)) < 0) {
+    perror("Cannot create shared memory ring");
+  }
+  else if ((mem = mmap(NULL, sizeof(shm_region), PROT_READ | PROT_WRITE,
+                       MAP_SHARED, mem_fd, 0)) == MAP_FAILED) {
+    perror("Cannot map shared memory ring");
+  }
+  else if (shm_send_fds(c, mem_fd) < 0) {
+    perror("Cannot pass shared memory ring");
+  }
+  else {
+    c->shm = (shm_region*)mem; // zero filled by ftruncate
+  }
+  if (mem_fd >= 0) {
+    close(mem_fd); // the mapping keeps the memory
+  }
+
+  if (c->shm != NULL && r.uring == NULL) {
+    struct epoll_event ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN | EPOLLET;
+    ev.data.u64 = c->conn_id | SHM_ID_BIT;
+    if (epoll_ctl(r.epoll_fd, EPOLL_CTL_ADD, c->shm_req_fd, &ev) < 0) {
+      perror("epoll_ctl shm");
+      c->shm = NULL;
+    }
+  }
+#if IO_URING
+  if (c->shm != NULL && r.uring != NULL) {
+    uring_poll_shm(r, c);
+  }
+#endif
+  if (c->shm == NULL) {
+    if (mem != MAP_FAILED) {
+      munmap(mem, sizeof(shm_region));
+    }
+    if (c->shm_req_fd >= 0) {
+      close(c->shm_req_fd);
+    }
+    if (c->shm_resp_fd >= 0) {
+      close(c->shm_resp_fd);
+    }
+    c->shm_req_fd = -1;
+    c->shm_resp_fd = -1;
+    return reject_conn(r, c);
+  }
+  // requests may already be waiting in the ring
+  return shm_read(r, c);
+}
+
+
+
+
+
+
+/*   the client has broken the indices of a ring, end the session   */
+// close_conn unmaps the rings through shm_detach, returns -1
+int shm_corrupt (reactor& r, conn_state* c) {
+  std::cerr << "shm ring of connection " << c->conn_id << " is corrupted" << std::endl;
+  close_conn(r, c);
+  return -1;
+}
+
+
+
+
+
+
+/*   move requests out of the ring and continue a response waiting for room   */
+// the socket itself only tells when the client goes away;
+// returns -1 if the connection has been closed
+int shm_read (reactor& r, conn_state* c) {
+  uint64_t count;
+  bool moved = false;
+
+  // io_uring keeps a recv on the socket which reports the end of stream
+  while (r.uring == NULL && !c->peer_closed) {
+    char scratch[64];
+    ssize_t len = recv(c->fd, scratch, sizeof(scratch), 0);
+    if (len > 0 || (len < 0 && errno == EINTR)) {
+      continue; // nothing but the preface is expected on the socket
+    }
+    if (len < 0 && errno != EAGAIN && errno != EWOULDBLOCK) {
+      perror("request recv");
+      close_conn(r, c);
+      return -1;
+    }
+    if (len == 0) { // connection is closed by the client
+      c->peer_closed = true;
+    }
+    break;
+  }
+
+  // reset the eventfd before looking at the ring so that no wake-up is lost
+  while (read(c->shm_req_fd, &count, sizeof(count)) > 0) {
+  }
+  while (frame_status(c->dec) != FRAME_ERROR) {
+    if (c->ready_bytes >= MAX_PENDING) {
+      c->read_paused = true; // resumed once the queued requests are answered
+      break;
+    }
+    long long space;
+    char* data = frame_space(c->dec, &space);
+    long long len = shm_ring_read(&c->shm->req, data, space);
+    if (len < 0) {
+      return shm_corrupt(r, c);
+    }
+    if (len == 0) {
+      break;
+    }
+    moved = true;
+    queue_frames(r, c, frame_commit(c->dec, len));
+  }
+  if (moved) {
+    shm_wake(c); // the client may write more now
+  }
+  if (c->out_head_len != 0) {
+    return flush_conn(r, c); // the client may have made room for the response
+  }
+  return process_conn(r, c);
+}
+
+
+
+
+
+
+/*   copy as much of the pending response as fits into the ring   */
+// returns -1 if the connection has been closed
+int shm_write (reactor& r, conn_state* c) {
+  struct iovec iov[RESPONSE_IOV];
+  int n = response_iov(c->out_head, c->out_head_len, c->out_buf, c->out_off,
+                       c->out_parts, iov);
+  bool moved = false;
+
+  for (int i = 0; i < n; ++i) {
+    long long len = shm_ring_write(&c->shm->resp, (const char*)iov[i].iov_base,
+                                   iov[i].iov_len);
+    if (len < 0) {
+      return shm_corrupt(r, c);
+    }
+    c->out_off += len;
+    moved = moved || len > 0;
+    if (len < (long long)iov[i].iov_len) {
+      break; // ring is full
+    }
+  }
+  if (moved) {
+    shm_wake(c);
+  }
+  if (response_iov(c->out_head, c->out_head_len, c->out_buf, c->out_off,
+                   c->out_parts, iov) > 0) {
+    return 0; // wait until the client has read from the ring
+  }
+  return sent_conn(r, c);
+}
+
+
+
+
+
+
+/*   release the rings and eventfds of a closing connection   */
+void shm_detach (reactor& r, conn_state* c) {
+  if (c->shm == NULL) {
+    return;
+  }
+#if IO_URING
+  if (r.uring != NULL) {
+    uring_cancel_shm(r, c);
+  }
+#endif
+  if (r.uring == NULL) {
+    // the client holds a copy, closing alone would not remove it from epoll
+    epoll_ctl(r.epoll_fd, EPOLL_CTL_DEL, c->shm_req_fd, NULL);
+  }
+  close(c->shm_req_fd);
+  close(c->shm_resp_fd);
+  munmap(c->shm, sizeof(shm_region));
+  c->shm = NULL;
+  c->shm_req_fd = -1;
+  c->shm_resp_fd = -1;
+  return;
+}
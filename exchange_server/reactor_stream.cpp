@@ -0,0 +1,191 @@
+#include <iostream>
+#include <string>
+#include <vector>
+
+// boost library for thread pool
+#include <boost/bind.hpp>
+#include <boost/asio.hpp>
+#include <boost/asio/thread_pool.hpp>
+
+#include "operations.h"
+#include "buffer_pool.h"
+#include "frame_decoder.h"
+#include "response.h"
+#include "reactor.h"
+
+#define DEBUG           0
+
+
+
+/*   <transactions> whose children are executed while it is being received   */
+// only the event loop parses, the children run in the thread pool of batch
+struct request_stream {
+  reactor* r;
+  long long conn_id;
+  long long tag;
+  long long body_start;       // offset of the XML in the frame
+  long long parsed;           // bytes of the XML parsed so far
+  long long num;              // children found so far
+  bool invalid;               // answered with "Invalid XML request" once complete
+  long long account_id;
+  transactions_batch* batch;  // NULL when the account is not a number
+  parsed_request req;         // children found by the last parse
+  result_slots results;       // one per child found so far
+  result_sink sink;           // results already sent on a chunked connection
+};
+
+
+
+
+
+
+/*   decode and execute the children found by the last parse   */
+void stream_children (request_stream* s) {
+  for (std::size_t i = 0; i < s->req.children.size(); ++i) {
+    if (s->batch != NULL) {
+      add_child(s->batch, s->req.children[i]);
+    }
+    ++s->num;
+  }
+  s->req.children.clear();
+  return;
+}
+
+
+
+
+
+
+/*   wait for the children of a stream and answer it, runs in the thread pool   */
+void finish_stream (request_stream* s) {
+  std::string* response = new std::string;
+  int stat = 0;
+
+  try {
+    if (s->batch != NULL) {
+      stat = close_transactions(s->batch);
+    }
+    else {
+      stat = -3; // not an account number, cannot exist
+    }
+    if (s->invalid) { // children which ran keep their results, the error follows
+      stat = stat == 0 && s->num > 0 ? -4 : -1;
+    }
+    render_results(stat, s->results, &s->sink, response);
+  }
+  catch (std::exception& e) {
+#if DEBUG
+    std::cerr << "finish_stream: " << e.what() << std::endl;
+#endif
+    render_results(-2, s->results, &s->sink, response);
+  }
+  complete_task(s->r, s->conn_id, s->tag, response);
+  delete s;
+  return;
+}
+
+
+
+
+
+
+/*   start executing a <transactions> whose root element has arrived   */
+// it takes the place of the frame in the admission queue
+request_stream* open_stream (reactor& r, conn_state* c, const parsed_request& req,
+                             long long parsed) {
+  request_stream* s = new request_stream;
+  s->r = &r;
+  s->conn_id = c->conn_id;
+  s->tag = frame_tagged(c->dec) ? c->dec.tag : NO_TAG;
+  s->body_start = c->dec.header_len;
+  s->parsed = parsed;
+  s->num = 0;
+  s->invalid = false;
+  s->batch = NULL;
+  s->req = req;
+  result_sink sink = { send_chunk, &r, s->conn_id, s->tag, 0 };
+  s->sink = sink;
+  if (decode_id(s->req.account, s->account_id) == DECODE_OK) {
+    // on a chunked connection the results go out while the rest arrives
+    s->batch = open_transactions(s->account_id, &s->results,
+                                 conn_chunked(c) ? &s->sink : NULL);
+  }
+
+  c->stream = s;
+  ++c->inflight;
+  if (!frame_tagged(c->dec)) {
+    c->busy = true; // answered before the next request is looked at
+  }
+  return s;
+}
+
+
+
+
+
+
+/*   parse what has arrived of the frame being received and execute its children   */
+// a frame is only streamed on a chunked connection and when its response may be
+// sent before the requests queued behind it, requests which are not
+// <transactions> wait until complete
+void stream_feed (reactor& r, conn_state* c) {
+  long long len;
+  const char* body = frame_body(c->dec, &len);
+
+  if (body == NULL || !conn_chunked(c) || c->closing) {
+    return;
+  }
+  if (c->stream == NULL) {
+    if (!frame_tagged(c->dec) && (c->busy || !c->ready.empty())) {
+      return; // not its turn yet
+    }
+    parsed_request req;
+    long long pos = 0;
+    if (parse_partial(body, len, pos, false, req) != STREAM_MORE || pos == 0) {
+      return; // root has not arrived, is not <transactions> or is invalid
+    }
+    if (!admit_request(*r.adm)) {
+      return; // answered with "server busy" once complete
+    }
+    stream_children(open_stream(r, c, req, pos));
+    return;
+  }
+
+  request_stream* s = c->stream;
+  if (s->invalid) {
+    return; // nothing more is executed
+  }
+  if (parse_partial(body, len, s->parsed, false, s->req) < 0) {
+    s->invalid = true;
+  }
+  stream_children(s);
+  return;
+}
+
+
+
+
+
+
+/*   the frame being streamed is complete or will not be, answer it when done   */
+// frame is the whole frame, what has arrived of it or NULL if the connection
+// has been closed
+void stream_end (reactor& r, conn_state* c, slab* frame) {
+  request_stream* s = c->stream;
+  c->stream = NULL;
+
+  if (frame == NULL) {
+    s->invalid = true;
+  }
+  else if (!s->invalid) {
+    int stat = parse_partial(frame->data + s->body_start, frame->len - s->body_start,
+                             s->parsed, true, s->req);
+    stream_children(s);
+    if (stat != STREAM_END || s->num == 0) {
+      s->invalid = true;
+    }
+  }
+  slab_put(frame);
+  boost::asio::post(*r.handler, boost::bind(finish_stream, s));
+  return;
+}
@@ -0,0 +1,608 @@
+#include <iostream>
+#include <string>
+#include <vector>
+#include <unordered_map>
+
+#include "reactor.h"
+
+#if IO_URING
+
+#include <stdint.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <string.h>
+
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+
+#define URING_ENTRIES   1024
+#define URING_BUF_COUNT 1024    // must be a power of 2
+#define URING_BUF_SIZE  4096
+#define URING_BUF_GROUP 0
+
+// kind of operation, stored in the low bits of user_data next to conn_id
+#define OP_BITS         3
+#define OP_MASK         7
+#define OP_ACCEPT       1
+#define OP_WAKE         2
+#define OP_RECV         3
+#define OP_SEND         4
+#define OP_CANCEL       5
+#define OP_SHM          6
+
+
+
+/*   io_uring instance of one reactor, driven with raw system calls   */
+struct uring_state {
+  int ring_fd;
+  void* ring;                 // SQ and CQ rings share one mapping
+  std::size_t ring_len;
+  struct io_uring_sqe* sqes;
+  std::size_t sqes_len;
+
+  // submission queue
+  unsigned* sq_head;
+  unsigned* sq_tail;
+  unsigned* sq_array;
+  unsigned sq_mask;
+  unsigned sq_entries;
+  unsigned sq_local_tail;     // includes sqes which are not yet published
+  unsigned sq_pending;        // sqes not yet passed to io_uring_enter
+
+  // completion queue
+  unsigned* cq_head;
+  unsigned* cq_tail;
+  unsigned cq_mask;
+  struct io_uring_cqe* cqes;
+
+  // receive buffers registered with the kernel, recv picks one per completion
+  struct io_uring_buf* buf_ring;
+  std::size_t buf_ring_len;
+  char* bufs;
+  unsigned short buf_tail;
+
+  bool multishot_accept;
+  bool multishot_recv;
+  uint64_t wake_val;          // target of the read on the eventfd
+
+  // connections closed while the kernel still reads their out_buf
+  std::unordered_map <long long, conn_state*> closed;
+};
+
+
+
+
+
+
+/*   unmap rings and release the io_uring instance   */
+void uring_free (uring_state* u) {
+  if (u->sqes != NULL) {
+    munmap(u->sqes, u->sqes_len);
+  }
+  if (u->ring != NULL) {
+    munmap(u->ring, u->ring_len);
+  }
+  if (u->buf_ring != NULL) {
+    munmap(u->buf_ring, u->buf_ring_len);
+  }
+  if (u->ring_fd >= 0) {
+    close(u->ring_fd);
+  }
+  delete[] u->bufs;
+  delete u;
+  return;
+}
+
+
+
+
+
+
+/*   publish queued sqes and optionally wait for one completion   */
+int uring_submit (uring_state* u, unsigned wait) {
+  __atomic_store_n(u->sq_tail, u->sq_local_tail, __ATOMIC_RELEASE);
+  int ret = syscall(__NR_io_uring_enter, u->ring_fd, u->sq_pending, wait,
+                    wait != 0 ? IORING_ENTER_GETEVENTS : 0, NULL, 0);
+  if (ret > 0) {
+    u->sq_pending -= ret;
+  }
+  return ret;
+}
+
+
+
+
+
+
+/*   get a zeroed submission entry, sqes are submitted in one batch per loop   */
+struct io_uring_sqe* uring_sqe (uring_state* u) {
+  while (u->sq_local_tail - __atomic_load_n(u->sq_head, __ATOMIC_ACQUIRE) >=
+         u->sq_entries) { // queue is full, hand the batch to the kernel now
+    if (uring_submit(u, 0) < 0 && errno != EINTR && errno != EAGAIN &&
+        errno != EBUSY) {
+      perror("io_uring_enter");
+      break;
+    }
+  }
+  unsigned index = u->sq_local_tail & u->sq_mask;
+  struct io_uring_sqe* sqe = &u->sqes[index];
+  memset(sqe, 0, sizeof(*sqe));
+  u->sq_array[index] = index;
+  ++u->sq_local_tail;
+  ++u->sq_pending;
+  return sqe;
+}
+
+
+
+
+
+
+/*   give a receive buffer back to the kernel   */
+// the ring is addressed as a plain array, in C++ the flexible array member of
+// io_uring_buf_ring is not at offset 0; the tail overlays resv of entry 0
+void uring_put_buf (uring_state* u, unsigned short bid) {
+  struct io_uring_buf* bufs = u->buf_ring;
+  struct io_uring_buf* buf = &bufs[u->buf_tail & (URING_BUF_COUNT - 1)];
+  buf->addr = (uint64_t)(u->bufs + (std::size_t)bid * URING_BUF_SIZE);
+  buf->len = URING_BUF_SIZE;
+  buf->bid = bid;
+  ++u->buf_tail;
+  __atomic_store_n(&bufs[0].resv, u->buf_tail, __ATOMIC_RELEASE);
+  return;
+}
+
+
+
+
+
+
+/*   (re)submit accept on the TCP or the unix-domain listening socket   */
+void uring_arm_accept (reactor& r, bool local) {
+  uring_state* u = r.uring;
+  struct io_uring_sqe* sqe = uring_sqe(u);
+  sqe->opcode = IORING_OP_ACCEPT;
+  sqe->fd = local ? r.unix_fd : r.listen_fd;
+  sqe->accept_flags = SOCK_CLOEXEC;
+  if (u->multishot_accept) {
+    sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+  }
+  sqe->user_data = ((uint64_t)local << OP_BITS) | OP_ACCEPT;
+  return;
+}
+
+
+
+
+
+
+/*   (re)submit read of the eventfd written by the workers   */
+void uring_arm_wake (reactor& r) {
+  uring_state* u = r.uring;
+  struct io_uring_sqe* sqe = uring_sqe(u);
+  sqe->opcode = IORING_OP_READ;
+  sqe->fd = r.wake_fd;
+  sqe->addr = (uint64_t)&u->wake_val;
+  sqe->len = sizeof(u->wake_val);
+  sqe->off = (uint64_t)-1;
+  sqe->user_data = OP_WAKE;
+  return;
+}
+
+
+
+
+
+
+/*   cancel the multishot recv of a connection   */
+void uring_cancel_recv (reactor& r, conn_state* c) {
+  struct io_uring_sqe* sqe = uring_sqe(r.uring);
+  sqe->opcode = IORING_OP_ASYNC_CANCEL;
+  sqe->addr = ((uint64_t)c->conn_id << OP_BITS) | OP_RECV;
+  sqe->user_data = OP_CANCEL;
+  return;
+}
+
+
+
+
+
+
+/*   wait for the client to move one of its shared-memory rings   */
+void uring_poll_shm (reactor& r, conn_state* c) {
+  struct io_uring_sqe* sqe = uring_sqe(r.uring);
+  sqe->opcode = IORING_OP_POLL_ADD;
+  sqe->fd = c->shm_req_fd;
+  sqe->poll32_events = POLLIN;
+  sqe->user_data = ((uint64_t)c->conn_id << OP_BITS) | OP_SHM;
+  return;
+}
+
+
+
+
+
+
+/*   cancel the eventfd poll of a closing shared-memory connection   */
+void uring_cancel_shm (reactor& r, conn_state* c) {
+  struct io_uring_sqe* sqe = uring_sqe(r.uring);
+  sqe->opcode = IORING_OP_ASYNC_CANCEL;
+  sqe->addr = ((uint64_t)c->conn_id << OP_BITS) | OP_SHM;
+  sqe->user_data = OP_CANCEL;
+  return;
+}
+
+
+
+
+
+
+/*   create the ring, register receive buffers and arm accept and wake-up   */
+int uring_init (reactor& r) {
+  struct io_uring_params params;
+  uring_state* u = new uring_state;
+
+  memset(&params, 0, sizeof(params));
+  u->ring = NULL;
+  u->sqes = NULL;
+  u->buf_ring = NULL;
+  u->bufs = NULL;
+  params.flags = IORING_SETUP_CLAMP;
+  u->ring_fd = syscall(__NR_io_uring_setup, URING_ENTRIES, &params);
+  if (u->ring_fd < 0) {
+    perror("io_uring_setup");
+    uring_free(u);
+    return -1;
+  }
+  if (!(params.features & IORING_FEAT_SINGLE_MMAP) ||
+      !(params.features & IORING_FEAT_NODROP)) {
+    uring_free(u);
+    return -1; // kernel too old for this backend
+  }
+
+  // map submission and completion rings and the submission entries
+  std::size_t sq_len = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+  std::size_t cq_len = params.cq_off.cqes +
+                       params.cq_entries * sizeof(struct io_uring_cqe);
+  u->ring_len = sq_len > cq_len ? sq_len : cq_len;
+  u->ring = mmap(NULL, u->ring_len, PROT_READ | PROT_WRITE,
+                 MAP_SHARED | MAP_POPULATE, u->ring_fd, IORING_OFF_SQ_RING);
+  if (u->ring == MAP_FAILED) {
+    u->ring = NULL;
+    perror("io_uring mmap");
+    uring_free(u);
+    return -1;
+  }
+  u->sqes_len = params.sq_entries * sizeof(struct io_uring_sqe);
+  u->sqes = (struct io_uring_sqe*)mmap(NULL, u->sqes_len, PROT_READ | PROT_WRITE,
+                                       MAP_SHARED | MAP_POPULATE, u->ring_fd,
+                                       IORING_OFF_SQES);
+  if (u->sqes == MAP_FAILED) {
+    u->sqes = NULL;
+    perror("io_uring mmap");
+    uring_free(u);
+    return -1;
+  }
+  char* ring = (char*)u->ring;
+  u->sq_head = (unsigned*)(ring + params.sq_off.head);
+  u->sq_tail = (unsigned*)(ring + params.sq_off.tail);
+  u->sq_array = (unsigned*)(ring + params.sq_off.array);
+  u->sq_mask = *(unsigned*)(ring + params.sq_off.ring_mask);
+  u->sq_entries = *(unsigned*)(ring + params.sq_off.ring_entries);
+  u->sq_local_tail = *u->sq_tail;
+  u->sq_pending = 0;
+  u->cq_head = (unsigned*)(ring + params.cq_off.head);
+  u->cq_tail = (unsigned*)(ring + params.cq_off.tail);
+  u->cq_mask = *(unsigned*)(ring + params.cq_off.ring_mask);
+  u->cqes = (struct io_uring_cqe*)(ring + params.cq_off.cqes);
+
+  // register the receive buffer ring (linux 5.19)
+  struct io_uring_buf_reg reg;
+  u->buf_ring_len = URING_BUF_COUNT * sizeof(struct io_uring_buf);
+  u->buf_ring = (struct io_uring_buf*)mmap(NULL, u->buf_ring_len,
+                                                PROT_READ | PROT_WRITE,
+                                                MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (u->buf_ring == MAP_FAILED) {
+    u->buf_ring = NULL;
+    perror("io_uring buffer ring");
+    uring_free(u);
+    return -1;
+  }
+  memset(&reg, 0, sizeof(reg));
+  reg.ring_addr = (uint64_t)u->buf_ring;
+  reg.ring_entries = URING_BUF_COUNT;
+  reg.bgid = URING_BUF_GROUP;
+  if (syscall(__NR_io_uring_register, u->ring_fd, IORING_REGISTER_PBUF_RING,
+              &reg, 1) < 0) {
+    perror("io_uring register buffers");
+    uring_free(u);
+    return -1;
+  }
+  u->bufs = new char[(std::size_t)URING_BUF_COUNT * URING_BUF_SIZE];
+  u->buf_tail = 0;
+  for (unsigned i = 0; i < URING_BUF_COUNT; ++i) {
+    uring_put_buf(u, i);
+  }
+
+  // io_uring waits by itself, sockets it owns stay blocking
+  int flags = fcntl(r.listen_fd, F_GETFL, 0);
+  fcntl(r.listen_fd, F_SETFL, flags & ~O_NONBLOCK);
+  flags = fcntl(r.wake_fd, F_GETFL, 0);
+  fcntl(r.wake_fd, F_SETFL, flags & ~O_NONBLOCK);
+  if (r.unix_fd >= 0) {
+    flags = fcntl(r.unix_fd, F_GETFL, 0);
+    fcntl(r.unix_fd, F_SETFL, flags & ~O_NONBLOCK);
+  }
+
+  u->multishot_accept = true;
+  u->multishot_recv = true;
+  r.uring = u;
+  uring_arm_accept(r, false);
+  if (r.unix_fd >= 0) {
+    uring_arm_accept(r, true);
+  }
+  uring_arm_wake(r);
+  return 0;
+}
+
+
+
+
+
+
+/*   submit recv on a connection unless one is running or reading is paused   */
+// returns -1 if the connection has been closed
+int uring_recv (reactor& r, conn_state* c) {
+  uring_state* u = r.uring;
+
+  // shared-memory clients keep a recv only to see the end of stream
+  if (!c->recv_armed && !c->peer_closed && (want_read(c) || c->shm != NULL)) {
+    if (c->shm == NULL && c->ready_bytes >= MAX_PENDING) {
+      c->read_paused = true; // resumed once the queued requests are answered
+    }
+    else {
+      struct io_uring_sqe* sqe = uring_sqe(u);
+      sqe->opcode = IORING_OP_RECV;
+      sqe->fd = c->fd;
+      sqe->flags = IOSQE_BUFFER_SELECT;
+      sqe->buf_group = URING_BUF_GROUP;
+      if (u->multishot_recv) {
+        sqe->ioprio = IORING_RECV_MULTISHOT;
+      }
+      else {
+        sqe->len = URING_BUF_SIZE;
+      }
+      sqe->user_data = ((uint64_t)c->conn_id << OP_BITS) | OP_RECV;
+      c->recv_armed = true;
+    }
+  }
+  return process_conn(r, c);
+}
+
+
+
+
+
+
+/*   submit gather send of the rest of the pending response   */
+int uring_send (reactor& r, conn_state* c) {
+  if (c->send_inflight) {
+    return 0; // continued from the completion
+  }
+  // the kernel reads out_msg and out_iov until the completion arrives
+  memset(&c->out_msg, 0, sizeof(c->out_msg));
+  c->out_msg.msg_iov = c->out_iov;
+  c->out_msg.msg_iovlen = response_iov(c->out_head, c->out_head_len, c->out_buf,
+                                       c->out_off, c->out_parts, c->out_iov);
+  struct io_uring_sqe* sqe = uring_sqe(r.uring);
+  sqe->opcode = IORING_OP_SENDMSG;
+  sqe->fd = c->fd;
+  sqe->addr = (uint64_t)&c->out_msg;
+  sqe->len = 1;
+  sqe->msg_flags = MSG_NOSIGNAL;
+  sqe->user_data = ((uint64_t)c->conn_id << OP_BITS) | OP_SEND;
+  c->send_inflight = true;
+  return 0;
+}
+
+
+
+
+
+
+/*   close the socket, keep the connection until its send has completed   */
+void uring_close (reactor& r, conn_state* c) {
+  // shutdown terminates the outstanding recv, the ring holds its own reference
+  shutdown(c->fd, SHUT_RDWR);
+  close(c->fd);
+  if (c->send_inflight) {
+    r.uring->closed[c->conn_id] = c;
+    return;
+  }
+  free_conn(c);
+  return;
+}
+
+
+
+
+
+
+/*   received bytes (or end of stream) for a connection   */
+void uring_recv_done (reactor& r, conn_state* c, struct io_uring_cqe& cqe) {
+  uring_state* u = r.uring;
+
+  if (!(cqe.flags & IORING_CQE_F_MORE)) {
+    c->recv_armed = false;
+  }
+  if (cqe.res > 0) {
+    unsigned short bid = cqe.flags >> IORING_CQE_BUFFER_SHIFT;
+    const char* data = u->bufs + (std::size_t)bid * URING_BUF_SIZE;
+    long long left = cqe.res;
+    while (left > 0 && want_read(c)) {
+      long long space;
+      char* dst = frame_space(c->dec, &space);
+      if (space > left) {
+        space = left;
+      }
+      memcpy(dst, data, space);
+      data += space;
+      left -= space;
+      queue_frames(r, c, frame_commit(c->dec, space));
+    }
+    uring_put_buf(u, bid);
+    if (c->recv_armed && c->shm == NULL &&
+        (!want_read(c) || c->ready_bytes >= MAX_PENDING)) {
+      uring_cancel_recv(r, c);
+    }
+    uring_recv(r, c);
+    return;
+  }
+  if (cqe.res == 0) { // connection is closed by the client
+    c->peer_closed = true;
+    process_conn(r, c);
+    return;
+  }
+  if (cqe.res == -ENOBUFS || cqe.res == -ECANCELED) {
+    uring_recv(r, c); // re-armed unless reading is paused
+    return;
+  }
+  if (cqe.res == -EINVAL && u->multishot_recv) { // kernel older than 6.0
+    u->multishot_recv = false;
+    uring_recv(r, c);
+    return;
+  }
+  errno = -cqe.res;
+  perror("request recv");
+  close_conn(r, c);
+  return;
+}
+
+
+
+
+
+
+/*   part of the response has been sent   */
+void uring_send_done (reactor& r, struct io_uring_cqe& cqe) {
+  long long conn_id = cqe.user_data >> OP_BITS;
+  std::unordered_map <long long, conn_state*>::iterator it = r.conns.find(conn_id);
+
+  if (it == r.conns.end()) { // closed meanwhile, out_buf may be released now
+    it = r.uring->closed.find(conn_id);
+    if (it != r.uring->closed.end()) {
+      free_conn(it->second);
+      r.uring->closed.erase(it);
+    }
+    return;
+  }
+  conn_state* c = it->second;
+  c->send_inflight = false;
+  if (cqe.res < 0) {
+    errno = -cqe.res;
+    perror("response send");
+    close_conn(r, c);
+    return;
+  }
+  c->out_off += cqe.res;
+  if (response_iov(c->out_head, c->out_head_len, c->out_buf, c->out_off,
+                   c->out_parts, c->out_iov) > 0) { // short send, continue
+    uring_send(r, c);
+    return;
+  }
+  sent_conn(r, c);
+  return;
+}
+
+
+
+
+
+
+/*   dispatch one completion   */
+void uring_complete (reactor& r, struct io_uring_cqe& cqe) {
+  uring_state* u = r.uring;
+  int op = cqe.user_data & OP_MASK;
+
+  if (op == OP_ACCEPT) {
+    bool local = (cqe.user_data >> OP_BITS) != 0;
+    if (cqe.res >= 0) {
+      conn_state* c = add_conn(r, cqe.res, local);
+      if (c != NULL) {
+        uring_recv(r, c);
+      }
+    }
+    else if (cqe.res == -EINVAL && u->multishot_accept) { // kernel older than 5.19
+      u->multishot_accept = false;
+    }
+    else {
+      errno = -cqe.res;
+      perror("Cannot accept connection");
+    }
+    if (!(cqe.flags & IORING_CQE_F_MORE)) {
+      uring_arm_accept(r, local);
+    }
+  }
+  else if (op == OP_WAKE) {
+    collect_done(r);
+    uring_arm_wake(r);
+  }
+  else if (op == OP_RECV) {
+    std::unordered_map <long long, conn_state*>::iterator it =
+      r.conns.find(cqe.user_data >> OP_BITS);
+    if (it != r.conns.end()) {
+      uring_recv_done(r, it->second, cqe);
+    }
+    else if (cqe.flags & IORING_CQE_F_BUFFER) { // connection is gone
+      uring_put_buf(u, cqe.flags >> IORING_CQE_BUFFER_SHIFT);
+    }
+  }
+  else if (op == OP_SEND) {
+    uring_send_done(r, cqe);
+  }
+  else if (op == OP_SHM && cqe.res >= 0) {
+    long long conn_id = cqe.user_data >> OP_BITS;
+    std::unordered_map <long long, conn_state*>::iterator it = r.conns.find(conn_id);
+    if (it != r.conns.end() && read_conn(r, it->second) >= 0) {
+      it = r.conns.find(conn_id); // may have been closed while answering
+      if (it != r.conns.end() && it->second->shm != NULL) {
+        uring_poll_shm(r, it->second);
+      }
+    }
+  }
+  return;
+}
+
+
+
+
+
+
+/*   event loop: one io_uring_enter submits the batch and waits for completions   */
+void uring_run (reactor& r) {
+  uring_state* u = r.uring;
+
+  while (1) {
+    if (uring_submit(u, 1) < 0) {
+      if (errno == EINTR || errno == EAGAIN || errno == EBUSY) {
+        continue;
+      }
+      perror("io_uring_enter");
+      return;
+    }
+    unsigned head = *u->cq_head;
+    unsigned tail = __atomic_load_n(u->cq_tail, __ATOMIC_ACQUIRE);
+    while (head != tail) {
+      struct io_uring_cqe cqe = u->cqes[head & u->cq_mask];
+      ++head;
+      __atomic_store_n(u->cq_head, head, __ATOMIC_RELEASE);
+      uring_complete(r, cqe);
+    }
+  }
+}
+
+#endif
@@ -0,0 +1,524 @@
+#include <string>
+#include <vector>
+
+#include <string.h>
+
+#include "request_parser.h"
+#include "scan_simd.h"
+
+#define MAX_TAG_ATTRS   4       // one more than any element may have
+#define NAME_TABLE      32      // name_hash is perfect for the names below
+
+// element and attribute names of the grammar
+#define NAME_UNKNOWN        0
+#define NAME_CREATE         1
+#define NAME_TRANSACTIONS   2
+#define NAME_ACCOUNT        3
+#define NAME_SYMBOL         4
+#define NAME_ORDER          5
+#define NAME_CANCEL         6
+#define NAME_QUERY          7
+#define NAME_ID             8
+#define NAME_BALANCE        9
+#define NAME_SYM            10
+#define NAME_AMOUNT         11
+#define NAME_LIMIT          12
+
+// hash of a string literal, usable as a case label
+#define NAME_HASH(s)    name_hash(s, sizeof(s) - 1)
+
+
+
+/*   position in the request being parsed   */
+struct scanner {
+  const char* p;
+  const char* end;
+};
+
+
+
+/*   start, end or empty element tag   */
+struct xml_tag {
+  text_view name;
+  int name_id;                // NAME_*
+  int attr_id[MAX_TAG_ATTRS]; // NAME_* of each attribute
+  text_view attr_value[MAX_TAG_ATTRS];
+  int attr_count;             // number of attributes, may exceed MAX_TAG_ATTRS
+  bool closing;               // </name>
+  bool empty;                 // <name .../>
+};
+
+
+
+
+
+
+/*   slot of a name in the dispatch of lookup_name   */
+// computed by the compiler for the names of the grammar, two of them with
+// the same hash would be duplicate case labels and not compile
+constexpr unsigned name_hash (const char* s, long long len) {
+  return len == 0 ? 0 :
+         (len + (unsigned char)s[0] * 11 + (unsigned char)s[len - 1]) % NAME_TABLE;
+}
+
+
+
+
+
+
+/*   copy the viewed characters into a string   */
+std::string view_str (text_view v) {
+  return std::string(v.ptr, v.len);
+}
+
+
+
+
+
+
+/*   whether the viewed characters are exactly s   */
+bool view_is (text_view v, const char* s) {
+  return (long long)strlen(s) == v.len && memcmp(v.ptr, s, v.len) == 0;
+}
+
+
+
+
+
+
+/*   NAME_* of an element or attribute name   */
+// one hash and one comparison instead of comparing with every name in turn
+int lookup_name (text_view v) {
+  switch (name_hash(v.ptr, v.len)) {
+  case NAME_HASH("create"):
+    return view_is(v, "create") ? NAME_CREATE : NAME_UNKNOWN;
+  case NAME_HASH("transactions"):
+    return view_is(v, "transactions") ? NAME_TRANSACTIONS : NAME_UNKNOWN;
+  case NAME_HASH("account"):
+    return view_is(v, "account") ? NAME_ACCOUNT : NAME_UNKNOWN;
+  case NAME_HASH("symbol"):
+    return view_is(v, "symbol") ? NAME_SYMBOL : NAME_UNKNOWN;
+  case NAME_HASH("order"):
+    return view_is(v, "order") ? NAME_ORDER : NAME_UNKNOWN;
+  case NAME_HASH("cancel"):
+    return view_is(v, "cancel") ? NAME_CANCEL : NAME_UNKNOWN;
+  case NAME_HASH("query"):
+    return view_is(v, "query") ? NAME_QUERY : NAME_UNKNOWN;
+  case NAME_HASH("id"):
+    return view_is(v, "id") ? NAME_ID : NAME_UNKNOWN;
+  case NAME_HASH("balance"):
+    return view_is(v, "balance") ? NAME_BALANCE : NAME_UNKNOWN;
+  case NAME_HASH("sym"):
+    return view_is(v, "sym") ? NAME_SYM : NAME_UNKNOWN;
+  case NAME_HASH("amount"):
+    return view_is(v, "amount") ? NAME_AMOUNT : NAME_UNKNOWN;
+  case NAME_HASH("limit"):
+    return view_is(v, "limit") ? NAME_LIMIT : NAME_UNKNOWN;
+  default:
+    return NAME_UNKNOWN;
+  }
+}
+
+
+
+
+
+
+/*   white space between elements   */
+bool is_space (char c) {
+  return c == ' ' || c == '\n' || c == '\r' || c == '\t';
+}
+
+
+
+
+
+
+/*   character which ends an element or attribute name   */
+bool is_name_end (char c) {
+  return is_space(c) || c == '/' || c == '>' || c == '=' || c == '<';
+}
+
+
+
+
+
+
+/*   skip spaces, returns false at the end of the request   */
+bool skip_space (scanner& s) {
+  while (s.p < s.end && is_space(*s.p)) {
+    ++s.p;
+  }
+  return s.p < s.end;
+}
+
+
+
+
+
+
+/*   read an element or attribute name   */
+int scan_name (scanner& s, text_view& name) {
+  name.ptr = s.p;
+  while (s.p < s.end && !is_name_end(*s.p)) {
+    ++s.p;
+  }
+  name.len = s.p - name.ptr;
+  return name.len > 0 ? 0 : -1;
+}
+
+
+
+
+
+
+/*   read the tag starting at the '<' under the scanner   */
+int scan_tag (scanner& s, xml_tag& tag) {
+  tag.attr_count = 0;
+  tag.closing = false;
+  tag.empty = false;
+
+  ++s.p; // '<'
+  if (s.p < s.end && *s.p == '/') {
+    tag.closing = true;
+    ++s.p;
+  }
+  if (scan_name(s, tag.name) < 0) {
+    return -1; // also comments, CDATA and processing instructions
+  }
+  tag.name_id = lookup_name(tag.name);
+  while (skip_space(s)) {
+    char c = *s.p;
+    if (c == '>') {
+      ++s.p;
+      return 0;
+    }
+    if (c == '/' && !tag.closing) {
+      ++s.p;
+      if (s.p == s.end || *s.p != '>') {
+        return -1;
+      }
+      ++s.p;
+      tag.empty = true;
+      return 0;
+    }
+    if (tag.closing) {
+      return -1; // end tags have no attributes
+    }
+
+    // name="value" or name='value'
+    text_view name;
+    if (scan_name(s, name) < 0 || !skip_space(s) || *s.p != '=') {
+      return -1;
+    }
+    ++s.p;
+    if (!skip_space(s) || (*s.p != '"' && *s.p != '\'')) {
+      return -1;
+    }
+    char quote = *s.p++;
+    const char* value = s.p;
+    s.p = find_either(s.p, s.end, quote, '<');
+    if (s.p == s.end || *s.p != quote) {
+      return -1;
+    }
+    if (tag.attr_count < MAX_TAG_ATTRS) {
+      tag.attr_id[tag.attr_count] = lookup_name(name);
+      tag.attr_value[tag.attr_count].ptr = value;
+      tag.attr_value[tag.attr_count].len = s.p - value;
+    }
+    ++tag.attr_count;
+    ++s.p; // closing quote
+  }
+  return -1; // request ends inside the tag
+}
+
+
+
+
+
+
+/*   read the next tag, the text before it is returned in text   */
+int next_tag (scanner& s, xml_tag& tag, text_view& text) {
+  text.ptr = s.p;
+  s.p = find_either(s.p, s.end, '<', '<');
+  text.len = s.p - text.ptr;
+  if (s.p == s.end) {
+    return -1; // element is not closed
+  }
+  return scan_tag(s, tag);
+}
+
+
+
+
+
+
+/*   put the attributes of a tag into the slots given by names   */
+// attributes may come in any order, each of names must appear exactly once
+// and no other attribute is allowed
+bool fill_attrs (xml_tag& tag, const int* names, int count, text_view* attr) {
+  bool seen[MAX_TAG_ATTRS] = { false };
+
+  if (tag.attr_count != count) {
+    return false;
+  }
+  for (int i = 0; i < count; ++i) {
+    int slot = 0;
+    while (slot < count && names[slot] != tag.attr_id[i]) {
+      ++slot;
+    }
+    if (slot == count || seen[slot]) { // unknown or repeated attribute
+      return false;
+    }
+    seen[slot] = true;
+    attr[slot] = tag.attr_value[i];
+  }
+  return true;
+}
+
+
+
+
+
+
+/*   <symbol sym="">, its accounts up to and including </symbol>   */
+int parse_symbol (scanner& s, parsed_request& req, child_record& child) {
+  xml_tag tag;
+  text_view text;
+
+  child.first_share = req.shares.size();
+  child.num_shares = 0;
+  while (1) {
+    if (next_tag(s, tag, text) < 0) {
+      return -1;
+    }
+    if (tag.name_id == NAME_SYMBOL && tag.closing) {
+      return 0;
+    }
+    // <account id="">NUM</account>, the name of the attribute is not checked
+    if (tag.name_id != NAME_ACCOUNT || tag.closing || tag.empty ||
+        tag.attr_count != 1) {
+      return -1;
+    }
+    share_record share;
+    share.id = tag.attr_value[0];
+    if (next_tag(s, tag, share.shares) < 0 || share.shares.len == 0 ||
+        tag.name_id != NAME_ACCOUNT || !tag.closing) {
+      return -1;
+    }
+    req.shares.push_back(share);
+    ++child.num_shares;
+  }
+}
+
+
+
+
+
+
+/*   one child element of the root, -1 if it is none of the allowed ones   */
+int parse_child (scanner& s, parsed_request& req, xml_tag& tag) {
+  // attribute slots of each element, in the order of child_record.attr
+  static const int account_attrs[] = { NAME_ID, NAME_BALANCE };
+  static const int symbol_attrs[] = { NAME_SYM };
+  static const int order_attrs[] = { NAME_SYM, NAME_AMOUNT, NAME_LIMIT };
+  static const int id_attrs[] = { NAME_ID };
+  const int* names;
+  child_record child;
+  int count;
+
+  if (tag.closing) {
+    return -1;
+  }
+  switch (tag.name_id) {
+  case NAME_ACCOUNT: // <account id="" balance=""/>
+    child.type = CHILD_ACCOUNT;
+    names = account_attrs;
+    count = 2;
+    break;
+  case NAME_SYMBOL: // <symbol sym="">
+    child.type = CHILD_SYMBOL;
+    names = symbol_attrs;
+    count = 1;
+    break;
+  case NAME_ORDER: // <order sym="" amount="" limit=""/>
+    child.type = CHILD_ORDER;
+    names = order_attrs;
+    count = 3;
+    break;
+  case NAME_CANCEL: // <cancel id=""/>
+    child.type = CHILD_CANCEL;
+    names = id_attrs;
+    count = 1;
+    break;
+  case NAME_QUERY: // <query id=""/>
+    child.type = CHILD_QUERY;
+    names = id_attrs;
+    count = 1;
+    break;
+  default:
+    return -1; // invalid XML request
+  }
+  bool in_create = child.type == CHILD_ACCOUNT || child.type == CHILD_SYMBOL;
+  if (in_create != (req.root == ROOT_CREATE) ||
+      tag.empty == (child.type == CHILD_SYMBOL)) {
+    return -1; // wrong root, or <symbol/> and <order>...</order>
+  }
+  for (int i = 0; i < MAX_ATTRS; ++i) { // unused by this element
+    child.attr[i].ptr = NULL;
+    child.attr[i].len = 0;
+  }
+  if (!fill_attrs(tag, names, count, child.attr)) {
+    return -1;
+  }
+  child.first_share = 0;
+  child.num_shares = 0;
+  if (child.type == CHILD_SYMBOL && parse_symbol(s, req, child) < 0) {
+    return -1;
+  }
+  req.children.push_back(child);
+  return 0;
+}
+
+
+
+
+
+
+/*   optional XML declaration and the start tag of the root   */
+int parse_root (scanner& s, parsed_request& req) {
+  static const int transactions_attrs[] = { NAME_ACCOUNT };
+  xml_tag tag;
+
+  // optional XML declaration
+  if (skip_space(s) && s.end - s.p >= 2 && memcmp(s.p, "<?", 2) == 0) {
+    while (s.p < s.end && !(*s.p == '>' && s.p[-1] == '?')) {
+      ++s.p;
+    }
+    if (s.p == s.end) {
+      return -1;
+    }
+    ++s.p;
+  }
+
+  // root element
+  if (!skip_space(s) || *s.p != '<' || scan_tag(s, tag) < 0 ||
+      tag.closing || tag.empty) {
+    return -1;
+  }
+  if (tag.name_id == NAME_CREATE) {
+    req.root = ROOT_CREATE;
+  }
+  else if (tag.name_id == NAME_TRANSACTIONS &&
+           fill_attrs(tag, transactions_attrs, 1, &req.account)) {
+    req.root = ROOT_TRANSACTIONS;
+  }
+  else {
+    return -1;
+  }
+  return 0;
+}
+
+
+
+
+
+
+/*   whether the tag ends the root element   */
+bool is_root_end (xml_tag& tag, parsed_request& req) {
+  return tag.closing &&
+         tag.name_id == (req.root == ROOT_CREATE ? NAME_CREATE : NAME_TRANSACTIONS);
+}
+
+
+
+
+
+
+/*   parse "<len>\n<xml>" in one pass over the receive buffer   */
+// returns -1 for anything the <create>/<transactions> grammar does not allow
+int parse_request (const char* data, long long len, parsed_request& req) {
+  scanner s;
+  xml_tag tag;
+  text_view text;
+  const char* line_end = (const char*)memchr(data, '\n', len);
+
+  if (line_end == NULL) {
+    return -1; // invalid format
+  }
+  s.p = line_end + 1; // ignore the first line (integer)
+  s.end = data + len;
+  req.children.clear();
+  req.shares.clear();
+  if (parse_root(s, req) < 0) {
+    return -1;
+  }
+
+  // children up to the end tag of the root, text between them is ignored
+  while (1) {
+    if (next_tag(s, tag, text) < 0) {
+      return -1;
+    }
+    if (is_root_end(tag, req)) {
+      break;
+    }
+    if (parse_child(s, req, tag) < 0) {
+      return -1;
+    }
+  }
+  if (skip_space(s)) {
+    return -1; // only one root element
+  }
+  if (req.children.empty()) {
+    return -1; // no child
+  }
+  return 0;
+}
+
+
+
+
+
+
+/*   parse as much of a partly received <transactions> as has arrived   */
+// data is the XML received so far and pos the offset up to which it has been
+// parsed, it is advanced past every complete child appended to req.children.
+// Once complete is set all of the XML has arrived and running out of it is
+// an error. Returns STREAM_MORE, STREAM_END, STREAM_ROOT if the root is not
+// <transactions> or -1 for an invalid request
+int parse_partial (const char* data, long long len, long long& pos, bool complete,
+                   parsed_request& req) {
+  scanner s;
+  xml_tag tag;
+  text_view text;
+
+  s.p = data + pos;
+  s.end = data + len;
+  if (pos == 0) {
+    if (parse_root(s, req) < 0) {
+      return (s.p == s.end && !complete) ? STREAM_MORE : -1;
+    }
+    if (req.root != ROOT_TRANSACTIONS) {
+      return STREAM_ROOT;
+    }
+    pos = s.p - data;
+  }
+  while (next_tag(s, tag, text) == 0) {
+    if (is_root_end(tag, req)) {
+      if (!complete) {
+        return STREAM_MORE; // what follows is checked once all has arrived
+      }
+      if (skip_space(s)) {
+        return -1; // only one root element
+      }
+      pos = s.p - data;
+      return STREAM_END;
+    }
+    if (parse_child(s, req, tag) < 0) {
+      break;
+    }
+    pos = s.p - data;
+  }
+  // a tag cut off by the end of the received bytes is parsed again later
+  return (s.p == s.end && !complete) ? STREAM_MORE : -1;
+}
@@ -0,0 +1,71 @@
+#ifndef REQUEST_PARSER_H
+#define REQUEST_PARSER_H
+
+#include <string>
+#include <vector>
+
+// root element of a request
+#define ROOT_CREATE         0
+#define ROOT_TRANSACTIONS   1
+
+// child elements, attributes are stored in the order given here
+#define CHILD_ACCOUNT       0       // <account id="" balance=""/>
+#define CHILD_SYMBOL        1       // <symbol sym=""><account id="">NUM</account>...
+#define CHILD_ORDER         2       // <order sym="" amount="" limit=""/>
+#define CHILD_CANCEL        3       // <cancel id=""/>
+#define CHILD_QUERY         4       // <query id=""/>
+#define MAX_ATTRS           3
+
+// results of parse_partial
+#define STREAM_MORE         0       // wait for more of the request
+#define STREAM_END          1       // end tag of the root and nothing after it
+#define STREAM_ROOT         2       // not a <transactions>, parse it as a whole
+
+
+
+/*   characters of the receive buffer, nothing is copied   */
+struct text_view {
+  const char* ptr;
+  long long len;
+};
+
+
+
+/*   <account id="">NUM</account> inside a <symbol>   */
+struct share_record {
+  text_view id;
+  text_view shares;
+};
+
+
+
+/*   one child element of <create> or <transactions>   */
+struct child_record {
+  int type;                   // CHILD_*
+  text_view attr[MAX_ATTRS];
+  long long first_share;      // <symbol> only: its accounts in parsed_request.shares
+  long long num_shares;
+};
+
+
+
+/*   result of parsing one request, points into the receive buffer   */
+struct parsed_request {
+  int root;                   // ROOT_*
+  text_view account;          // account attribute of <transactions>
+  std::vector <child_record> children;
+  std::vector <share_record> shares;
+};
+
+
+
+int parse_request (const char* data, long long len, parsed_request& req);
+
+int parse_partial (const char* data, long long len, long long& pos, bool complete,
+                   parsed_request& req);
+
+std::string view_str (text_view v);
+
+bool view_is (text_view v, const char* s);
+
+#endif
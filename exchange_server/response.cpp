@@ -0,0 +1,77 @@
+#include <string>
+
+#include <stdio.h>
+#include <sys/uio.h>
+
+#include "response.h"
+#include "binary_protocol.h"
+
+
+
+/*   write the length line of a response, the length counts the body only   */
+// a response to a pipelined request repeats its correlation tag, a binary
+// one has the 12 byte head of binary_protocol.h; returns the length of the line
+int response_head (const std::string& body, long long tag, bool binary, char* head) {
+  if (binary) {
+    for (int i = 0; i < 4; ++i) { // little-endian length
+      head[i] = (char)(body.length() >> (8 * i));
+    }
+    for (int i = 0; i < 8; ++i) { // and tag
+      head[4 + i] = (char)((unsigned long long)tag >> (8 * i));
+    }
+    return BIN_FRAME_HEAD;
+  }
+  if (tag == NO_TAG) {
+    return snprintf(head, RESPONSE_HEAD_SIZE, "%zu\n", body.length());
+  }
+  return snprintf(head, RESPONSE_HEAD_SIZE, "%zu %lld\n", body.length(), tag);
+}
+
+
+
+
+
+
+/*   write the length line of one chunk of a response on a chunked connection   */
+// unlike response_head the length counts every byte up to the next length
+// line, the XML prolog goes with the first chunk; returns the length of the line
+int chunk_head (const std::string& body, bool first, char* head) {
+  std::size_t len = body.length() + (first ? sizeof(XML_PROLOG) - 1 : 0);
+  return snprintf(head, RESPONSE_HEAD_SIZE, "%zu\n", len);
+}
+
+
+
+
+
+
+/*   fragments of a response still to be sent after off bytes   */
+// length line, XML prolog, body and CHUNK_END are sent with one gather write
+// instead of being copied into one string, parts has the SEND_* which are sent
+// besides head and body; returns the number of iovecs, 0 when all is sent
+int response_iov (const char* head, int head_len, const std::string& body,
+                  std::size_t off, int parts, struct iovec* iov) {
+  const char* part[RESPONSE_IOV] = { head, XML_PROLOG, body.data(), CHUNK_END };
+  std::size_t part_len[RESPONSE_IOV] = {
+    (std::size_t)head_len,
+    (parts & SEND_PROLOG) ? sizeof(XML_PROLOG) - 1 : 0,
+    body.length(),
+    (parts & SEND_CHUNK_END) ? sizeof(CHUNK_END) - 1 : 0
+  };
+  int n = 0;
+
+  if (head_len == 0) {
+    return 0; // no response
+  }
+  for (int i = 0; i < RESPONSE_IOV; ++i) {
+    if (off >= part_len[i]) { // already sent
+      off -= part_len[i];
+      continue;
+    }
+    iov[n].iov_base = (void*)(part[i] + off);
+    iov[n].iov_len = part_len[i] - off;
+    off = 0;
+    ++n;
+  }
+  return n;
+}
@@ -0,0 +1,27 @@
+#ifndef RESPONSE_H
+#define RESPONSE_H
+
+#include <string>
+
+#include <sys/uio.h>
+
+#define XML_PROLOG          "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n"
+#define CHUNK_END           "0\n"   // last chunk of a response on a chunked connection
+#define RESPONSE_HEAD_SIZE  48      // "<len> <tag>\n" of any response fits
+#define NO_TAG              -1      // response to an untagged request
+#define RESPONSE_IOV        4       // length line, XML prolog, body, CHUNK_END
+
+// parts sent around the body, see response_iov
+#define SEND_PROLOG         1
+#define SEND_CHUNK_END      2
+
+
+
+int response_head (const std::string& body, long long tag, bool binary, char* head);
+
+int chunk_head (const std::string& body, bool first, char* head);
+
+int response_iov (const char* head, int head_len, const std::string& body,
+                  std::size_t off, int parts, struct iovec* iov);
+
+#endif
@@ -0,0 +1,264 @@
+#include <string>
+#include <vector>
+#include <deque>
+
+#include <stdlib.h>
+
+#include "order_command.h"
+#include "result.h"
+
+// bounds on the XML of one result and one item, numbers and messages included
+#define XML_RESULT_MAX  192
+#define XML_ITEM_MAX    112
+
+// text of the XML <error> elements, indexed by ERR_*
+static const char* const error_messages[ERR_COUNT] = {
+  "",
+  "Invalid account number",
+  "Invalid balance value",
+  "Invalid account or balance",
+  "Account already exists",
+  "Account does not exist",
+  "Negative share value",
+  "Invalid request...",
+  "Invalid amount",
+  "Invalid limit",
+  "\n    Invalid amount or limit\n  ",
+  "\n    Shares of symbol not enough\n  ",
+  "\n    Insufficient funds\n  ",
+  "\n    Order does not exist\n  ",
+  "\n    Unable to match order\n  ",
+  "Invalid request!",
+  "Order does not exist",
+  "Order is complete, nothing to cancel",
+  "Unable to cancel order",
+  "Unable to query order"
+};
+
+
+
+/*   result of a child   */
+op_result make_result (int kind, int error, long long id) {
+  op_result res;
+  res.kind = kind;
+  res.error = error;
+  res.id = id;
+  res.sym_id = -1;
+  res.amount = 0;
+  res.price = 0;
+  return res;
+}
+
+
+
+
+
+
+/*   entry of a result   */
+result_item make_item (int kind, int error, long long id, long long shares,
+                       long long price, long long time) {
+  result_item item = { kind, error, id, shares, price, time };
+  return item;
+}
+
+
+
+
+
+
+/*   slot for the next child of a request   */
+// empty until the child is done, a child which is never executed renders
+// nothing
+op_result* add_slot (result_slots* results) {
+  results->push_back(make_result(RESULT_TEXT, ERR_NONE, -1));
+  return &results->back();
+}
+
+
+
+
+
+
+/*   space the XML of slots first up to last takes at most   */
+// the response is allocated once instead of growing with every line
+std::size_t xml_size (const result_slots& results, std::size_t first, std::size_t last) {
+  std::size_t size = 0;
+  for (std::size_t i = first; i < last; ++i) {
+    const op_result& res = results[i];
+    size += XML_RESULT_MAX + XML_ITEM_MAX * res.items.size() + res.text.size();
+    if (res.sym_id >= 0) {
+      size += symbol_name(res.sym_id).size();
+    }
+    size += res.sym.size();
+  }
+  return size;
+}
+
+
+
+
+
+
+/*   <executed>, <canceled> and <open> of an order's history   */
+void render_history (const op_result& res, std::string* response) {
+  for (std::size_t i = 0; i < res.items.size(); ++i) {
+    const result_item& item = res.items[i];
+    if (item.kind == ITEM_EXECUTED) {
+      APPEND_LITERAL(response, "    <executed shares=\"");
+      append_int(response, llabs(item.shares));
+      APPEND_LITERAL(response, "\" price=\"");
+      append_price(response, item.price);
+      APPEND_LITERAL(response, "\" time=\"");
+      append_int(response, item.time);
+      APPEND_LITERAL(response, "\"/>\n");
+    }
+    else if (item.kind == ITEM_CANCELED) {
+      APPEND_LITERAL(response, "    <canceled shares=\"");
+      append_int(response, llabs(item.shares));
+      APPEND_LITERAL(response, "\" time=\"");
+      append_int(response, item.time);
+      APPEND_LITERAL(response, "\"/>\n");
+    }
+    else if (item.kind == ITEM_OPEN) {
+      APPEND_LITERAL(response, "    <open shares=\"");
+      append_int(response, llabs(item.shares));
+      APPEND_LITERAL(response, "\"/>\n");
+    }
+  }
+  return;
+}
+
+
+
+
+
+
+/*   <error id="">message</error>   */
+void render_id_error (long long id, int error, const char* indent, std::string* response) {
+  response->append(indent);
+  APPEND_LITERAL(response, "<error id=\"");
+  append_int(response, id);
+  APPEND_LITERAL(response, "\">");
+  response->append(error_messages[error]);
+  APPEND_LITERAL(response, "</error>\n");
+  return;
+}
+
+
+
+
+
+
+/*   <symbol> of a <create>, <created sym=""> unless one of the accounts failed   */
+void render_symbol (const op_result& res, std::string* response) {
+  bool failed = false;
+  for (std::size_t j = 0; j < res.items.size(); ++j) {
+    if (res.items[j].kind == ITEM_ERROR) {
+      failed = true;
+    }
+  }
+  if (failed) {
+    APPEND_LITERAL(response, "  <error sym=\"");
+  }
+  else {
+    APPEND_LITERAL(response, "  <created sym=\"");
+  }
+  response->append(res.sym_id >= 0 ? symbol_name(res.sym_id) : res.sym);
+  APPEND_LITERAL(response, "\">\n");
+  for (std::size_t j = 0; j < res.items.size(); ++j) {
+    const result_item& item = res.items[j];
+    if (item.kind == ITEM_CREATED) {
+      APPEND_LITERAL(response, "    <created id=\"");
+      append_int(response, item.id);
+      APPEND_LITERAL(response, "\"/>\n");
+    }
+    else {
+      render_id_error(item.id, item.error, "    ", response);
+    }
+  }
+  if (failed) {
+    APPEND_LITERAL(response, "  </error>\n");
+  }
+  else {
+    APPEND_LITERAL(response, "  </created>\n");
+  }
+  return;
+}
+
+
+
+
+
+
+/*   <opened> or <error> of an <order>, it repeats sym, amount and limit   */
+void render_order (const op_result& res, std::string* response) {
+  if (res.kind == RESULT_OPENED) {
+    APPEND_LITERAL(response, "  <opened id=\"");
+    append_int(response, res.id);
+    APPEND_LITERAL(response, "\" sym=\"");
+  }
+  else {
+    APPEND_LITERAL(response, "  <error sym=\"");
+  }
+  response->append(res.sym_id >= 0 ? symbol_name(res.sym_id) : res.sym);
+  APPEND_LITERAL(response, "\" amount=\"");
+  append_int(response, llabs(res.amount));
+  APPEND_LITERAL(response, "\" limit=\"");
+  append_price(response, res.price);
+  if (res.kind == RESULT_OPENED) {
+    APPEND_LITERAL(response, "\"/>\n");
+  }
+  else {
+    APPEND_LITERAL(response, "\">");
+    response->append(error_messages[res.error]);
+    APPEND_LITERAL(response, "</error>\n");
+  }
+  return;
+}
+
+
+
+
+
+
+/*   children of <results> from slot first up to last, in the order of the request   */
+// appended piece by piece to response, which is reserved with xml_size
+void render_xml (const result_slots& results, std::size_t first, std::size_t last,
+                 std::string* response) {
+  for (std::size_t i = first; i < last; ++i) {
+    const op_result& res = results[i];
+
+    if (res.kind == RESULT_CREATED) {
+      APPEND_LITERAL(response, "  <created id=\"");
+      append_int(response, res.id);
+      APPEND_LITERAL(response, "\"/>\n");
+    }
+    else if (res.kind == RESULT_ERROR) {
+      render_id_error(res.id, res.error, "  ", response);
+    }
+    else if (res.kind == RESULT_SYMBOL) {
+      render_symbol(res, response);
+    }
+    else if (res.kind == RESULT_OPENED || res.kind == RESULT_ORDER_ERROR) {
+      render_order(res, response);
+    }
+    else if (res.kind == RESULT_CANCELED) {
+      APPEND_LITERAL(response, "  <canceled id=\"");
+      append_int(response, res.id);
+      APPEND_LITERAL(response, "\">\n");
+      render_history(res, response);
+      APPEND_LITERAL(response, "  </canceled>\n");
+    }
+    else if (res.kind == RESULT_STATUS) {
+      APPEND_LITERAL(response, "  <status id=\"");
+      append_int(response, res.id);
+      APPEND_LITERAL(response, "\">\n");
+      render_history(res, response);
+      APPEND_LITERAL(response, "  </status>\n");
+    }
+    else { // RESULT_TEXT
+      response->append(res.text);
+    }
+  }
+  return;
+}
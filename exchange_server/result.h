@@ -0,0 +1,123 @@
+#ifndef RESULT_H
+#define RESULT_H
+
+#include <string>
+#include <vector>
+#include <deque>
+
+// outcome of one child element
+#define RESULT_CREATED      0       // account created
+#define RESULT_ERROR        1       // account or order id with an error
+#define RESULT_SYMBOL       2       // shares added, one item per account
+#define RESULT_OPENED       3       // order placed
+#define RESULT_ORDER_ERROR  4       // order not placed
+#define RESULT_CANCELED     5       // order canceled, items are its history
+#define RESULT_STATUS       6       // order queried, items are its history
+#define RESULT_TEXT         7       // XML rendered while decoding the request
+
+// entries inside a result
+#define ITEM_CREATED        0       // shares added to an account
+#define ITEM_ERROR          1       // shares not added to an account
+#define ITEM_EXECUTED       2
+#define ITEM_CANCELED       3
+#define ITEM_OPEN           4
+
+// append a string literal, its length is known at compile time
+#define APPEND_LITERAL(out, lit)  (out)->append(lit, sizeof(lit) - 1)
+
+// errors, indexed into the messages of result.cpp
+#define ERR_NONE            0
+#define ERR_ACCOUNT_NUMBER  1
+#define ERR_BALANCE         2
+#define ERR_ACCOUNT_FORMAT  3
+#define ERR_ACCOUNT_EXISTS  4
+#define ERR_NO_ACCOUNT      5
+#define ERR_NEGATIVE_SHARES 6
+#define ERR_CREATE          7
+#define ERR_AMOUNT          8
+#define ERR_LIMIT           9
+#define ERR_ORDER_FORMAT    10
+#define ERR_SHARES          11
+#define ERR_FUNDS           12
+#define ERR_ORDER_RECORD    13
+#define ERR_MATCH           14
+#define ERR_ORDER           15
+#define ERR_NO_ORDER        16
+#define ERR_COMPLETE        17
+#define ERR_CANCEL          18
+#define ERR_QUERY           19
+#define ERR_COUNT           20
+
+
+
+/*   account of a <symbol> or one entry of an order's history   */
+struct result_item {
+  int kind;                   // ITEM_*
+  int error;                  // ERR_* of an ITEM_ERROR
+  long long id;               // account id of ITEM_CREATED and ITEM_ERROR
+  long long shares;
+  long long price;            // in ticks
+  long long time;
+};
+
+
+
+/*   what one child element of a request came to   */
+// operations fill these in, the response is rendered from them once all
+// children are done, as XML or as binary records
+struct op_result {
+  int kind;                   // RESULT_*
+  int error;                  // ERR_* of RESULT_ERROR and RESULT_ORDER_ERROR
+  long long id;               // account id or order id
+  int sym_id;                 // RESULT_SYMBOL, RESULT_OPENED, RESULT_ORDER_ERROR
+  std::string sym;            // the symbol when sym_id is -1, not interned
+  long long amount;           // shares of an order
+  long long price;            // limit of an order in ticks
+  std::vector <result_item> items;
+  std::string text;           // RESULT_TEXT only
+};
+
+
+
+/*   results of a request, slot i belongs to its child i   */
+// each slot is written by the one thread executing its child, without a
+// lock, and the slots are rendered in order once all children are done.
+// A deque because slots are added while earlier ones are being filled
+// (streamed requests) and must stay in place.
+typedef std::deque<op_result> result_slots;
+
+
+
+struct result_sink;
+
+/*   hands a chunk of a response to its connection, which takes it over   */
+typedef void (*chunk_fn) (result_sink* sink, std::string* chunk);
+
+
+
+/*   connection the results of a request are sent to before all are done   */
+// results go out in request order, each one as soon as it and every result
+// before it are done; the rest of the response follows as usual
+struct result_sink {
+  chunk_fn send;
+  void* owner;                // reactor of the connection
+  long long conn_id;
+  long long tag;
+  std::size_t sent;           // slots already sent, after "<results>\n"
+};
+
+
+
+op_result make_result (int kind, int error, long long id);
+
+result_item make_item (int kind, int error, long long id, long long shares,
+                       long long price, long long time);
+
+op_result* add_slot (result_slots* results);
+
+std::size_t xml_size (const result_slots& results, std::size_t first, std::size_t last);
+
+void render_xml (const result_slots& results, std::size_t first, std::size_t last,
+                 std::string* response);
+
+#endif
@@ -0,0 +1,176 @@
+#include <string.h>
+#include <stdint.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define X86_KERNELS     1
+#else
+#define X86_KERNELS     0
+#endif
+
+#include "scan_simd.h"
+
+#define SWAR_ONES       0x0101010101010101ULL
+
+typedef const char* (*find_fn) (const char* p, const char* end, char a, char b);
+
+
+
+/*   first a or b from p on, end if there is none   */
+const char* find_either_scalar (const char* p, const char* end, char a, char b) {
+  while (p < end && *p != a && *p != b) {
+    ++p;
+  }
+  return p;
+}
+
+
+
+
+
+
+#if X86_KERNELS
+/*   find_either 16 bytes at a time, SSE2 is part of every x86-64 cpu   */
+const char* find_either_sse2 (const char* p, const char* end, char a, char b) {
+  const __m128i va = _mm_set1_epi8(a);
+  const __m128i vb = _mm_set1_epi8(b);
+
+  for (; end - p >= 16; p += 16) {
+    __m128i v = _mm_loadu_si128((const __m128i*)p);
+    int mask = _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(v, va),
+                                              _mm_cmpeq_epi8(v, vb)));
+    if (mask != 0) {
+      return p + __builtin_ctz(mask);
+    }
+  }
+  return find_either_scalar(p, end, a, b);
+}
+
+
+
+
+
+
+/*   find_either 32 bytes at a time   */
+__attribute__((target("avx2")))
+const char* find_either_avx2 (const char* p, const char* end, char a, char b) {
+  const __m256i va = _mm256_set1_epi8(a);
+  const __m256i vb = _mm256_set1_epi8(b);
+
+  for (; end - p >= 32; p += 32) {
+    __m256i v = _mm256_loadu_si256((const __m256i*)p);
+    unsigned mask = _mm256_movemask_epi8(_mm256_or_si256(_mm256_cmpeq_epi8(v, va),
+                                                         _mm256_cmpeq_epi8(v, vb)));
+    if (mask != 0) {
+      return p + __builtin_ctz(mask);
+    }
+  }
+  return find_either_sse2(p, end, a, b);
+}
+#endif
+
+
+
+
+
+
+/*   kernel for this cpu, looked up once at startup   */
+find_fn choose_find () {
+#if SIMD_SCAN && X86_KERNELS
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2")) {
+    return find_either_avx2;
+  }
+  return find_either_sse2;
+#else
+  return find_either_scalar;
+#endif
+}
+
+static const find_fn find_impl = choose_find();
+
+
+
+
+
+
+/*   first a or b from p on, end if there is none   */
+// used for the runs of text and attribute values between delimiters
+const char* find_either (const char* p, const char* end, char a, char b) {
+  return find_impl(p, end, a, b);
+}
+
+
+
+
+
+
+/*   name of the kernel behind find_either, printed at startup   */
+const char* scan_kernel () {
+#if X86_KERNELS
+  if (find_impl == find_either_avx2) {
+    return "avx2";
+  }
+  if (find_impl == find_either_sse2) {
+    return "sse2";
+  }
+#endif
+  return "scalar";
+}
+
+
+
+
+
+
+/*   whether all 8 bytes of x are ASCII digits   */
+bool swar_digits (uint64_t x) {
+  // '0'..'9' is 0x30..0x39, adding 6 must not carry out of the low nibble
+  return ((x & (0xF0 * SWAR_ONES)) == 0x30 * SWAR_ONES) &&
+         (((x + 0x06 * SWAR_ONES) & (0xF0 * SWAR_ONES)) == 0x30 * SWAR_ONES);
+}
+
+
+
+
+
+
+/*   value of 8 ASCII digits, the first one in the lowest byte   */
+uint64_t swar_value (uint64_t x) {
+  x -= 0x30 * SWAR_ONES;
+  x = (x * 10 + (x >> 8)) & 0x00FF00FF00FF00FFULL;        // pairs
+  x = (x * 100 + (x >> 16)) & 0x0000FFFF0000FFFFULL;      // quads
+  x = (x * 10000 + (x >> 32)) & 0xFFFFFFFFULL;
+  return x;
+}
+
+
+
+
+
+
+/*   value of the run of ASCII digits at p, returns the number of digits used   */
+// at most MAX_SCAN_DIGITS are converted so the value cannot overflow, the
+// caller goes on with the digits after them
+long long scan_digits (const char* p, const char* end, unsigned long long& value) {
+  const char* start = p;
+  const char* stop = end - p > MAX_SCAN_DIGITS ? p + MAX_SCAN_DIGITS : end;
+
+  value = 0;
+#if SIMD_SCAN && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+  // amounts, limits and ids usually take one or two words of 8 digits
+  while (stop - p >= 8) {
+    uint64_t x;
+    memcpy(&x, p, 8);
+    if (!swar_digits(x)) {
+      break;
+    }
+    value = value * 100000000ULL + swar_value(x);
+    p += 8;
+  }
+#endif
+  for (; p < stop && *p >= '0' && *p <= '9'; ++p) {
+    value = value * 10 + (*p - '0');
+  }
+  return p - start;
+}
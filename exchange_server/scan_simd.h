@@ -0,0 +1,17 @@
+#ifndef SCAN_SIMD_H
+#define SCAN_SIMD_H
+
+// 0 keeps the plain byte loops on every cpu
+#define SIMD_SCAN       1
+
+#define MAX_SCAN_DIGITS 18      // digits converted at once, below 2^63 whatever they are
+
+
+
+const char* find_either (const char* p, const char* end, char a, char b);
+
+long long scan_digits (const char* p, const char* end, unsigned long long& value);
+
+const char* scan_kernel ();
+
+#endif
@@ -0,0 +1,57 @@
+#include <string.h>
+
+#include "shm_ring.h"
+
+
+
+/*   consumer: copy up to len bytes out of the ring   */
+// returns the number of bytes copied, 0 if the ring is empty and -1 if head
+// and tail are more than a ring apart: the other side can write both of them
+long long shm_ring_read (shm_ring* ring, char* dst, long long len) {
+  uint64_t head = __atomic_load_n(&ring->head, __ATOMIC_RELAXED);
+  uint64_t tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+  uint64_t used = tail - head;  // huge if head has been moved past tail
+
+  if (used > SHM_RING_SIZE) {
+    return -1;
+  }
+  long long avail = used;
+  if (len > avail) {
+    len = avail;
+  }
+  long long off = head & (SHM_RING_SIZE - 1);
+  long long first = SHM_RING_SIZE - off < len ? SHM_RING_SIZE - off : len;
+  memcpy(dst, ring->data + off, first);
+  memcpy(dst + first, ring->data, len - first); // wrapped around
+  __atomic_store_n(&ring->head, head + len, __ATOMIC_RELEASE);
+  return len;
+}
+
+
+
+
+
+
+/*   producer: copy up to len bytes into the ring   */
+// returns the number of bytes copied, 0 if the ring is full and -1 if head
+// and tail are more than a ring apart
+long long shm_ring_write (shm_ring* ring, const char* src, long long len) {
+  uint64_t tail = __atomic_load_n(&ring->tail, __ATOMIC_RELAXED);
+  uint64_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+  uint64_t used = tail - head;
+
+  if (used > SHM_RING_SIZE) {
+    return -1;
+  }
+  long long room = SHM_RING_SIZE - (long long)used;
+
+  if (len > room) {
+    len = room;
+  }
+  long long off = tail & (SHM_RING_SIZE - 1);
+  long long first = SHM_RING_SIZE - off < len ? SHM_RING_SIZE - off : len;
+  memcpy(ring->data + off, src, first);
+  memcpy(ring->data, src + first, len - first); // wrapped around
+  __atomic_store_n(&ring->tail, tail + len, __ATOMIC_RELEASE);
+  return len;
+}
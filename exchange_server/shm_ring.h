@@ -0,0 +1,38 @@
+#ifndef SHM_RING_H
+#define SHM_RING_H
+
+#include <stdint.h>
+
+// bytes of each ring, must be a power of 2
+#define SHM_RING_SIZE   (1 << 20)
+#define CACHE_LINE      64
+
+
+
+/*   single-producer single-consumer byte ring in shared memory   */
+// head and tail count bytes since the start and only ever grow, each is
+// written by one side only and sits on its own cache line
+struct shm_ring {
+  alignas(CACHE_LINE) uint64_t head;          // advanced by the consumer
+  alignas(CACHE_LINE) uint64_t tail;          // advanced by the producer
+  alignas(CACHE_LINE) char data[SHM_RING_SIZE];
+};
+
+
+
+/*   memory shared with a co-located client after the "shm-ring\n" preface   */
+// the client writes "<len>\n<xml>" requests into req and reads the responses
+// from resp. Each side writes the eventfd of the other side after it has
+// added bytes to a ring or made room in one.
+struct shm_region {
+  shm_ring req;               // client -> server
+  shm_ring resp;              // server -> client
+};
+
+
+
+long long shm_ring_read (shm_ring* ring, char* dst, long long len);
+
+long long shm_ring_write (shm_ring* ring, const char* src, long long len);
+
+#endif
@@ -0,0 +1,164 @@
+#include <string>
+
+// database library
+#include <pqxx/pqxx>
+
+#include "order_command.h"
+#include "statements.h"
+
+struct statement {
+  const char* name;
+  const char* sql;
+};
+
+// parameters are bound as text, postgres takes their types from the columns
+static const statement statements[] = {
+  { STMT_ACCOUNT_COUNT,
+    "SELECT COUNT(ACCOUNT_ID) FROM ACCOUNT WHERE ACCOUNT_ID = $1;" },
+  { STMT_ACCOUNT_ID,
+    "SELECT ACCOUNT_ID FROM ACCOUNT WHERE ACCOUNT_ID = $1;" },
+  { STMT_INSERT_ACCOUNT,
+    "INSERT INTO ACCOUNT (ACCOUNT_ID, BALANCE) VALUES ($1, $2);" },
+  { STMT_SELECT_BALANCE,
+    "SELECT BALANCE FROM ACCOUNT WHERE ACCOUNT_ID = $1;" },
+  { STMT_UPDATE_BALANCE,
+    "UPDATE ACCOUNT SET BALANCE = $2 WHERE ACCOUNT_ID = $1;" },
+  { STMT_BALANCE_SHARES,
+    "SELECT BALANCE, COALESCE(SHARES, 0) FROM ACCOUNT LEFT JOIN POSITION " \
+    "ON POSITION.ACCOUNT_ID = ACCOUNT.ACCOUNT_ID AND SYM_ID = $2 " \
+    "WHERE ACCOUNT.ACCOUNT_ID = $1;" },
+
+  { STMT_SELECT_SYMBOL,
+    "SELECT SYM_ID FROM SYMBOL WHERE SYM = $1;" },
+  { STMT_INSERT_SYMBOL,
+    "INSERT INTO SYMBOL (SYM) VALUES ($1) ON CONFLICT (SYM) DO NOTHING;" },
+  { STMT_SELECT_SHARES,
+    "SELECT SHARES FROM POSITION WHERE ACCOUNT_ID = $1 AND SYM_ID = $2;" },
+  { STMT_UPDATE_SHARES,
+    "INSERT INTO POSITION (ACCOUNT_ID, SYM_ID, SHARES) VALUES ($1, $2, $3) " \
+    "ON CONFLICT (ACCOUNT_ID, SYM_ID) DO UPDATE SET SHARES = EXCLUDED.SHARES;" },
+
+  { STMT_MATCH_BUYERS,
+    "SELECT * FROM OPENED_ORDER WHERE SYM = $1 AND ACCOUNT_ID != $2 " \
+    "AND AMOUNT > 0 AND PRICE >= $3 ORDER BY PRICE DESC, TIME ASC;" },
+  { STMT_MATCH_SELLERS,
+    "SELECT * FROM OPENED_ORDER WHERE SYM = $1 AND ACCOUNT_ID != $2 " \
+    "AND AMOUNT < 0 AND PRICE <= $3 ORDER BY PRICE ASC, TIME ASC;" },
+  { STMT_BUYER_ORDER,
+    "SELECT ORDER_ID, AMOUNT FROM OPENED_ORDER WHERE ACCOUNT_ID = $1 " \
+    "AND SYM = $2 AND PRICE = $3 ORDER BY TIME ASC;" },
+  { STMT_SELLER_ORDER,
+    "SELECT ORDER_ID, AMOUNT FROM OPENED_ORDER WHERE ACCOUNT_ID = $1 " \
+    "AND SYM = $2 AND AMOUNT < 0 AND PRICE <= $3 ORDER BY PRICE ASC, TIME ASC;" },
+  { STMT_INSERT_OPENED,
+    "INSERT INTO OPENED_ORDER (ACCOUNT_ID, ORDER_ID, SYM, AMOUNT, PRICE, TIME) " \
+    "VALUES ($1, $2, $3, $4, $5, $6);" },
+  { STMT_UPDATE_OPENED,
+    "UPDATE OPENED_ORDER SET AMOUNT = $3 WHERE ACCOUNT_ID = $1 AND ORDER_ID = $2;" },
+  { STMT_DELETE_OPENED,
+    "DELETE FROM OPENED_ORDER WHERE ACCOUNT_ID = $1 AND ORDER_ID = $2;" },
+  { STMT_OPENED_COUNT,
+    "SELECT COUNT(*) FROM OPENED_ORDER WHERE ACCOUNT_ID = $1 AND ORDER_ID = $2;" },
+  { STMT_OPENED_AMOUNT,
+    "SELECT AMOUNT, PRICE FROM OPENED_ORDER WHERE ACCOUNT_ID = $1 AND ORDER_ID = $2;" },
+  { STMT_OPENED_ORDER,
+    "SELECT SYM, AMOUNT, PRICE FROM OPENED_ORDER " \
+    "WHERE ACCOUNT_ID = $1 AND ORDER_ID = $2;" },
+
+  { STMT_INSERT_CLOSED,
+    "INSERT INTO CLOSED_ORDER (ACCOUNT_ID, ORDER_ID, STATUS, SHARES, PRICE, TIME) " \
+    "VALUES ($1, $2, $3, $4, $5, $6);" },
+  { STMT_CLOSED_STATUS,
+    "SELECT STATUS FROM CLOSED_ORDER WHERE ACCOUNT_ID = $1 AND ORDER_ID = $2;" },
+  { STMT_CLOSED_ORDERS,
+    "SELECT * FROM CLOSED_ORDER WHERE ACCOUNT_ID = $1 AND ORDER_ID = $2;" },
+
+  { STMT_INSERT_ORDER_NUM,
+    "INSERT INTO ORDER_NUM (ACCOUNT_ID, NUM) VALUES ($1, 0);" },
+  { STMT_SELECT_ORDER_NUM,
+    "SELECT NUM FROM ORDER_NUM WHERE ACCOUNT_ID = $1;" },
+  { STMT_UPDATE_ORDER_NUM,
+    "UPDATE ORDER_NUM SET NUM = $2 WHERE ACCOUNT_ID = $1;" }
+};
+
+
+
+/*   declare every statement on a new connection of the pool   */
+// the server parses and plans a statement when the connection first executes
+// it, afterwards only the parameters are sent
+void prepare_statements (pqxx::connection* conn) {
+  for (std::size_t i = 0; i < sizeof(statements) / sizeof(statements[0]); ++i) {
+    conn->prepare(statements[i].name, statements[i].sql);
+  }
+  return;
+}
+
+
+
+
+
+
+/*   SYM_ID of a symbol, it is added to SYMBOL if new   */
+// looked up in the catalog, the database is only asked the first time; that
+// runs in a transaction of its own on conn, before the one of the operation,
+// so that the catalog only learns keys which are committed. A symbol added by
+// a concurrent transaction is waited for, not added twice. sym_id is -1 for
+// a symbol which is not interned, sym is its text then; it is interned once
+// it is in SYMBOL and sym_id is set
+long long symbol_key (pqxx::connection* conn, int& sym_id, const std::string& sym) {
+  if (sym_id >= 0 && catalog_key(sym_id) != NO_SYMBOL_KEY) {
+    return catalog_key(sym_id);
+  }
+
+  const std::string& name = sym_id >= 0 ? symbol_name(sym_id) : sym;
+  pqxx::work W(*conn);
+  pqxx::result R = W.prepared(STMT_SELECT_SYMBOL)(name).exec();
+  if (R.empty()) {
+    W.prepared(STMT_INSERT_SYMBOL)(name).exec();
+    R = W.prepared(STMT_SELECT_SYMBOL)(name).exec();
+  }
+  long long key = R[0][0].as<long long>();
+  W.commit();
+  if (sym_id < 0) {
+    text_view view = { name.data(), (long long)name.length() };
+    sym_id = intern_symbol(view);
+  }
+  if (sym_id >= 0) {
+    catalog_put(sym_id, key);
+  }
+  return key;
+}
+
+
+
+
+
+
+/*   SYM_ID of a symbol read from an order, which is in SYMBOL already   */
+long long stored_symbol_key (pqxx::work& W, const std::string& sym) {
+  text_view view = { sym.data(), (long long)sym.length() };
+  int sym_id = intern_symbol(view);
+  if (sym_id >= 0 && catalog_key(sym_id) != NO_SYMBOL_KEY) {
+    return catalog_key(sym_id);
+  }
+  pqxx::result R = W.prepared(STMT_SELECT_SYMBOL)(sym).exec();
+  long long key = R[0][0].as<long long>();
+  if (sym_id >= 0) {
+    catalog_put(sym_id, key); // the order was placed by a committed transaction
+  }
+  return key;
+}
+
+
+
+
+
+
+/*   shares of the symbol with SYM_ID sym_key held by an account   */
+long long position_shares (pqxx::work& W, long long account_id, long long sym_key) {
+  pqxx::result R = W.prepared(STMT_SELECT_SHARES)(account_id)(sym_key).exec();
+  if (R.empty()) {
+    return 0; // never held any
+  }
+  return R[0][0].as<long long>();
+}
@@ -0,0 +1,60 @@
+#ifndef STATEMENTS_H
+#define STATEMENTS_H
+
+#include <string>
+
+// database library
+#include <pqxx/pqxx>
+
+/*   names of the statements prepared on every connection of the pool,
+     executed with W.prepared(STMT_...)(param)...exec()   */
+
+// ACCOUNT
+#define STMT_ACCOUNT_COUNT      "account_count"     // $1 account
+#define STMT_ACCOUNT_ID         "account_id"        // $1 account
+#define STMT_INSERT_ACCOUNT     "insert_account"    // $1 account, $2 balance
+#define STMT_SELECT_BALANCE     "select_balance"    // $1 account
+#define STMT_UPDATE_BALANCE     "update_balance"    // $1 account, $2 balance
+#define STMT_BALANCE_SHARES     "balance_shares"    // $1 account, $2 sym_id
+
+// SYMBOL and POSITION, shares held of each symbol, no row means none
+#define STMT_SELECT_SYMBOL      "select_symbol"     // $1 sym
+#define STMT_INSERT_SYMBOL      "insert_symbol"     // $1 sym
+#define STMT_SELECT_SHARES      "select_shares"     // $1 account, $2 sym_id
+#define STMT_UPDATE_SHARES      "update_shares"     // $1 account, $2 sym_id, $3 shares
+
+// OPENED_ORDER
+#define STMT_MATCH_BUYERS       "match_buyers"      // $1 sym, $2 seller, $3 limit
+#define STMT_MATCH_SELLERS      "match_sellers"     // $1 sym, $2 buyer, $3 limit
+#define STMT_BUYER_ORDER        "buyer_order"       // $1 account, $2 sym, $3 price
+#define STMT_SELLER_ORDER       "seller_order"      // $1 account, $2 sym, $3 price
+#define STMT_INSERT_OPENED      "insert_opened"     // $1 account, $2 order, $3 sym,
+                                                    // $4 amount, $5 price, $6 time
+#define STMT_UPDATE_OPENED      "update_opened"     // $1 account, $2 order, $3 amount
+#define STMT_DELETE_OPENED      "delete_opened"     // $1 account, $2 order
+#define STMT_OPENED_COUNT       "opened_count"      // $1 account, $2 order
+#define STMT_OPENED_AMOUNT      "opened_amount"     // $1 account, $2 order
+#define STMT_OPENED_ORDER       "opened_order"      // $1 account, $2 order
+
+// CLOSED_ORDER
+#define STMT_INSERT_CLOSED      "insert_closed"     // $1 account, $2 order, $3 status,
+                                                    // $4 shares, $5 price, $6 time
+#define STMT_CLOSED_STATUS      "closed_status"     // $1 account, $2 order
+#define STMT_CLOSED_ORDERS      "closed_orders"     // $1 account, $2 order
+
+// ORDER_NUM
+#define STMT_INSERT_ORDER_NUM   "insert_order_num"  // $1 account
+#define STMT_SELECT_ORDER_NUM   "select_order_num"  // $1 account
+#define STMT_UPDATE_ORDER_NUM   "update_order_num"  // $1 account, $2 num
+
+
+
+void prepare_statements (pqxx::connection* conn);
+
+long long symbol_key (pqxx::connection* conn, int& sym_id, const std::string& sym);
+
+long long stored_symbol_key (pqxx::work& W, const std::string& sym);
+
+long long position_shares (pqxx::work& W, long long account_id, long long sym_key);
+
+#endif
@@ -15,11 +15,30 @@
 #include <arpa/inet.h>
 #include <time.h>
 #include <pthread.h>
+#include <poll.h>
+#include <map>
+#include <stdint.h>
+#include <sys/un.h>
+#include <sys/mman.h>
+
+#include "../../exchange_server/shm_ring.h"
+#include "../../exchange_server/response.h"
+#include "../../exchange_server/frame_decoder.h"
+#include "../../exchange_server/binary_protocol.h"
 
 /*   the host name and port number, for debugging only   */
 /*   may change if server executing in another machine   */
+#ifndef SERVER_ADDR
 #define SERVER_ADDR "vcm-2971.vm.duke.edu"
+#endif
 #define SERVER_PORT "12345"
+// unix-domain socket in the working directory of the server
+#ifndef SERVER_UNIX
+#define SERVER_UNIX "../../exchange_server/exchange_server.sock"
+#endif
+#define WAIT_MS     5000    // longest wait for a response
+// the length line of a response does not count the XML prolog
+#define PROLOG_SIZE (sizeof(XML_PROLOG) - 1)
 
 #define MAX_THREAD  1
 #define BUFF_SIZE   10240
@@ -97,7 +116,460 @@ void* handler (void* arg) {
 
 
 
+/*   content of a test case file   */
+std::string read_file (const char* path) {
+  std::ifstream fs(path);
+  std::stringstream ss;
+  if (fs.fail()) {
+    std::cerr << "cannot read " << path << std::endl;
+    exit(1);
+  }
+  ss << fs.rdbuf();
+  return ss.str();
+}
+
+
+
+/*   connect to the server over TCP   */
+int connect_tcp () {
+  struct addrinfo host_info;
+  struct addrinfo* host_info_list;
+
+  memset(&host_info, 0, sizeof(host_info));
+  host_info.ai_family   = AF_UNSPEC;
+  host_info.ai_socktype = SOCK_STREAM;
+  if (getaddrinfo(SERVER_ADDR, SERVER_PORT, &host_info, &host_info_list) != 0) {
+    std::cerr << "host not found\n";
+    exit(1);
+  }
+  int sfd = socket(host_info_list->ai_family, host_info_list->ai_socktype,
+                   host_info_list->ai_protocol);
+  if (sfd < 0) {
+    perror("socket");
+    exit(1);
+  }
+  if (connect(sfd, host_info_list->ai_addr, host_info_list->ai_addrlen) < 0) {
+    perror("server connect");
+    exit(1);
+  }
+  freeaddrinfo(host_info_list);
+  return sfd;
+}
+
+
+
+/*   append what the server sends next to in, false once it closed the socket   */
+bool recv_more (int sfd, std::string& in) {
+  char buf[BUFF_SIZE];
+  struct pollfd pfd;
+  pfd.fd = sfd;
+  pfd.events = POLLIN;
+  if (poll(&pfd, 1, WAIT_MS) <= 0) {
+    std::cerr << "no answer from the server" << std::endl;
+    exit(1);
+  }
+  int len = recv(sfd, buf, sizeof(buf), 0);
+  if (len <= 0) {
+    return false;
+  }
+  in.append(buf, len);
+  return true;
+}
+
+
+
+/*   connect to the unix-domain socket of the server   */
+int connect_unix () {
+  struct sockaddr_un addr;
+  int sfd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (sfd < 0) {
+    perror("socket");
+    exit(1);
+  }
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  strncpy(addr.sun_path, SERVER_UNIX, sizeof(addr.sun_path) - 1);
+  if (connect(sfd, (struct sockaddr*)&addr, sizeof(addr)) < 0) {
+    perror("unix connect");
+    exit(1);
+  }
+  return sfd;
+}
+
+
+
+/*   send "shm-ring\n" and receive the memory file and both eventfds   */
+// fds[0] is the memory, fds[1] the eventfd written by the client and
+// fds[2] the one written by the server
+void shm_handshake (int sfd, int* fds) {
+  char preface[sizeof("shm-ring\n")];
+  char ctrl[CMSG_SPACE(3 * sizeof(int))];
+  struct msghdr msg;
+  struct iovec iov;
+
+  send(sfd, "shm-ring\n", sizeof("shm-ring\n") - 1, 0);
+  memset(&msg, 0, sizeof(msg));
+  iov.iov_base = preface;
+  iov.iov_len = sizeof(preface) - 1;
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = ctrl;
+  msg.msg_controllen = sizeof(ctrl);
+  if (recvmsg(sfd, &msg, 0) <= 0 || CMSG_FIRSTHDR(&msg) == NULL) {
+    std::cerr << "shm-ring refused by the server" << std::endl;
+    exit(1);
+  }
+  memcpy(fds, CMSG_DATA(CMSG_FIRSTHDR(&msg)), 3 * sizeof(int));
+}
+
+
+
+/*   wait until the server writes its eventfd, false if it closed the socket   */
+bool shm_wait (int sfd, int resp_fd) {
+  struct pollfd pfd[2];
+  uint64_t count;
+  char byte;
+  pfd[0].fd = resp_fd;
+  pfd[0].events = POLLIN;
+  pfd[1].fd = sfd;
+  pfd[1].events = POLLIN;
+  if (poll(pfd, 2, WAIT_MS) <= 0) {
+    std::cerr << "no answer from the server" << std::endl;
+    exit(1);
+  }
+  if ((pfd[1].revents & (POLLIN | POLLHUP)) && recv(sfd, &byte, 1, MSG_DONTWAIT) == 0) {
+    return false;
+  }
+  while (read(resp_fd, &count, sizeof(count)) > 0) {
+  }
+  return true;
+}
+
+
+
+/*   send test cases through the shared memory rings of one session   */
+// every file is one request, the responses are printed as they come back.
+// With corrupt set, the head of the request ring is moved past its tail
+// after the request; the server has to end the session instead of reading it
+int shm_client (int num, char** files, bool corrupt) {
+  int fds[3];
+  uint64_t one = 1;
+  int sfd = connect_unix();
+
+  shm_handshake(sfd, fds);
+  shm_region* shm = (shm_region*)mmap(NULL, sizeof(shm_region), PROT_READ | PROT_WRITE,
+                                      MAP_SHARED, fds[0], 0);
+  if (shm == MAP_FAILED) {
+    perror("mmap");
+    return 1;
+  }
+
+  for (int i = 0; i < num; ++i) {
+    std::string xml = read_file(files[i]);
+    std::string req = std::to_string(xml.length()) + "\n" + xml;
+    std::string resp;
+    long long off = 0;
+    long long need = -1; // length line of the response not complete yet
+    
+    while (off < (long long)req.length()) {
+      long long n = shm_ring_write(&shm->req, req.data() + off, req.length() - off);
+      off += n;
+      if (corrupt) {
+        shm->req.head = shm->req.tail + 1; // the server must not trust it
+      }
+      write(fds[1], &one, sizeof(one));
+      if (off < (long long)req.length() && !shm_wait(sfd, fds[2])) {
+        std::cout << "session closed by the server" << std::endl;
+        return corrupt ? 0 : 1;
+      }
+    }
+    while (need < 0 || (long long)resp.length() < need) {
+      char buf[BUFF_SIZE];
+      long long n = shm_ring_read(&shm->resp, buf, sizeof(buf));
+      if (n > 0) {
+        resp.append(buf, n);
+        write(fds[1], &one, sizeof(one)); // made room
+        std::size_t eol = resp.find('\n');
+        if (need < 0 && eol != std::string::npos) {
+          need = eol + 1 + PROLOG_SIZE + atoll(resp.c_str());
+        }
+        continue;
+      }
+      if (!shm_wait(sfd, fds[2])) {
+        std::cout << "session closed by the server" << std::endl;
+        return corrupt ? 0 : 1;
+      }
+    }
+    std::cout << resp << std::endl;
+  }
+  if (corrupt) {
+    std::cout << "corrupted ring was not detected" << std::endl;
+    return 1;
+  }
+  close(sfd);
+  return 0;
+}
+
+
+
+/*   send test cases as tagged requests without waiting for the responses   */
+// the tag of the request for the i-th file is i + 1; responses may come back
+// in any order but every tag has to be answered exactly once
+int pipelined_client (int num, char** files) {
+  std::map <long long, std::string> answers;
+  std::map <long long, int> counts;
+  std::string req = "pipelined\n";
+  std::string in;
+  int sfd = connect_tcp();
+
+  for (int i = 0; i < num; ++i) {
+    std::string xml = read_file(files[i]);
+    req += std::to_string(xml.length()) + " " + std::to_string(i + 1) + "\n" + xml;
+    counts[i + 1] = 0;
+  }
+  send(sfd, req.c_str(), req.length(), 0);
+
+  for (int done = 0; done < num; ) {
+    std::size_t eol = in.find('\n');
+    long long len = PROLOG_SIZE + atoll(in.c_str());
+    if (eol == std::string::npos || in.length() < eol + 1 + len) {
+      if (!recv_more(sfd, in)) {
+        std::cout << "connection closed after " << done << " responses" << std::endl;
+        return 1;
+      }
+      continue;
+    }
+    long long tag = atoll(in.c_str() + in.find(' ') + 1);
+    if (counts.count(tag) == 0 || counts[tag]++ != 0) {
+      std::cout << "unexpected response for tag " << tag << std::endl;
+      return 1;
+    }
+    answers[tag] = in.substr(eol + 1, len);
+    in.erase(0, eol + 1 + len);
+    ++done;
+  }
+  // nothing may follow the last answer once the requests are over
+  shutdown(sfd, SHUT_WR);
+  while (recv_more(sfd, in)) {}
+  close(sfd);
+  if (!in.empty()) {
+    std::cout << "extra response: " << in << std::endl;
+    return 1;
+  }
+  // responses may arrive in any order, print them by tag
+  for (auto& a : answers) {
+    std::cout << "tag " << a.first << ":" << std::endl << a.second << std::endl;
+  }
+  std::cout << "every tag answered once" << std::endl;
+  return 0;
+}
+
+
+
+/*   take "<len>\n" and the len + extra bytes after it off in   */
+// returns len, or -1 if the server closed the socket before all of it arrived
+long long recv_counted (int sfd, std::string& in, long long extra, std::string& data) {
+  std::size_t eol;
+  while ((eol = in.find('\n')) == std::string::npos ||
+         in.length() < eol + 1 + extra + atoll(in.c_str())) {
+    if (!recv_more(sfd, in)) {
+      return -1;
+    }
+  }
+  long long len = atoll(in.c_str());
+  data = in.substr(0, eol + 1);
+  data += in.substr(eol + 1, len + extra);
+  in.erase(0, eol + 1 + len + extra);
+  return len;
+}
+
+
+
+/*   send every file to a persistent and to a chunked connection   */
+// the chunks of each response must join to the same document as the
+// unchunked response, and end with the CHUNK_END line
+int chunked_client (int num, char** files) {
+  std::string plain_in, chunked_in, plain, part;
+  int plain_sfd = connect_tcp();
+  int chunked_sfd = connect_tcp();
+  send(plain_sfd, "persistent\n", strlen("persistent\n"), 0);
+  send(chunked_sfd, "chunked\n", strlen("chunked\n"), 0);
+
+  for (int i = 0; i < num; ++i) {
+    std::string xml = read_file(files[i]);
+    std::string req = std::to_string(xml.length()) + "\n" + xml;
+    send(plain_sfd, req.c_str(), req.length(), 0);
+    send(chunked_sfd, req.c_str(), req.length(), 0);
+    if (recv_counted(plain_sfd, plain_in, PROLOG_SIZE, plain) < 0) {
+      std::cout << "persistent connection closed" << std::endl;
+      return 1;
+    }
+    plain.erase(0, plain.find('\n') + 1);
+
+    std::string joined;
+    long long len;
+    while ((len = recv_counted(chunked_sfd, chunked_in, 0, part)) > 0) {
+      joined += part.substr(part.find('\n') + 1);
+    }
+    if (len < 0 || part != CHUNK_END) {
+      std::cout << files[i] << ": chunked stream not ended by 0" << std::endl;
+      return 1;
+    }
+    std::cout << files[i] << ":" << std::endl << joined << std::endl;
+    if (joined != plain) {
+      std::cout << "differs from the unchunked response:" << std::endl << plain << std::endl;
+      return 1;
+    }
+  }
+  close(plain_sfd);
+  close(chunked_sfd);
+  std::cout << "the chunks join to the unchunked responses" << std::endl;
+  return 0;
+}
+
+
+
+/*   append value as a little-endian integer of size bytes   */
+void le_put (std::string& out, long long value, int size) {
+  for (int i = 0; i < size; ++i) {
+    out.push_back((char)(value & 0xff));
+    value >>= 8;
+  }
+}
+
+
+
+/*   little-endian integer of size bytes   */
+long long le_get (const char* p, int size) {
+  unsigned long long value = 0;
+  for (int i = size - 1; i >= 0; --i) {
+    value = (value << 8) | (unsigned char)p[i];
+  }
+  return value;
+}
+
+
+
+/*   binary messages of a test case file, one per create or transactions line   */
+// "account <id> <balance>", "shares <sym> <account> <shares>",
+// "order <sym> <amount> <limit>", "cancel <id>" and "query <id>" are the
+// records of the message above them, balances and limits are in ticks
+std::vector <std::string> read_binary (const char* path) {
+  std::vector <std::string> msgs;
+  std::istringstream file(read_file(path));
+  std::string line;
+
+  while (std::getline(file, line)) {
+    std::istringstream ls(line);
+    std::string op, sym;
+    long long a = 0, b = 0;
+    ls >> op;
+    if (op.empty() || op[0] == '#') {
+      continue;
+    }
+    if (op == "create" || op == "transactions") {
+      ls >> a;
+      msgs.push_back(std::string());
+      le_put(msgs.back(), op == "create" ? BIN_CREATE : BIN_TRANSACTIONS, 1);
+      le_put(msgs.back(), 0, 3);
+      le_put(msgs.back(), 0, 4);  // count, filled in below
+      le_put(msgs.back(), a, 8);
+      continue;
+    }
+    int rec_op = op == "account" ? BIN_ACCOUNT : op == "shares" ? BIN_SHARES :
+                 op == "order" ? BIN_ORDER : op == "cancel" ? BIN_CANCEL :
+                 op == "query" ? BIN_QUERY : -1;
+    if (rec_op < 0 || msgs.empty()) {
+      std::cerr << path << ": cannot use " << line << std::endl;
+      exit(1);
+    }
+    if (rec_op == BIN_SHARES || rec_op == BIN_ORDER) {
+      ls >> sym;
+    }
+    ls >> a >> b;
+    std::string& msg = msgs.back();
+    le_put(msg, rec_op, 1);
+    le_put(msg, 0, 7);
+    le_put(msg, a, 8);
+    le_put(msg, b, 8);
+    sym.resize(BIN_SYM_SIZE, '\0');
+    msg += sym;
+    long long count = (msg.length() - BIN_REQUEST_HEAD) / BIN_RECORD_SIZE;
+    for (int i = 0; i < 4; ++i) {
+      msg[4 + i] = (char)(count >> (8 * i));
+    }
+  }
+  return msgs;
+}
+
+
+
+/*   send the messages of a file over the binary protocol, one at a time   */
+// message num gets tag num, every response must repeat it
+int binary_client (const char* file) {
+  std::vector <std::string> msgs = read_binary(file);
+  std::string in;
+  int sfd = connect_tcp();
+  send(sfd, BINARY_PREFACE, strlen(BINARY_PREFACE), 0);
+
+  for (std::size_t i = 0; i < msgs.size(); ++i) {
+    long long tag = i + 1;
+    std::string frame;
+    le_put(frame, msgs[i].length(), 4);
+    le_put(frame, tag, 8);
+    frame += msgs[i];
+    send(sfd, frame.c_str(), frame.length(), 0);
+
+    while (in.length() < BIN_FRAME_HEAD ||
+           in.length() < BIN_FRAME_HEAD + (std::size_t)le_get(in.c_str(), 4)) {
+      if (!recv_more(sfd, in)) {
+        std::cout << "connection closed after " << i << " responses" << std::endl;
+        return 1;
+      }
+    }
+    const char* p = in.c_str();
+    long long len = le_get(p, 4);
+    if (le_get(p + 4, 8) != tag || len < BIN_RESPONSE_HEAD ||
+        (unsigned char)p[BIN_FRAME_HEAD] != BIN_RESPONSE) {
+      std::cout << "unexpected response to tag " << tag << std::endl;
+      return 1;
+    }
+    std::cout << "tag " << tag << ": status " << le_get(p + BIN_FRAME_HEAD + 1, 1)
+              << ", " << le_get(p + BIN_FRAME_HEAD + 4, 4) << " results" << std::endl;
+    long long items = 0;  // items of the last result still to come
+    for (long long off = BIN_RESPONSE_HEAD; off + BIN_RESULT_SIZE <= len;
+         off += BIN_RESULT_SIZE) {
+      const char* rec = p + BIN_FRAME_HEAD + off;
+      std::cout << (items > 0 ? "    item" : "  result") << " kind " << le_get(rec, 1)
+                << " error " << le_get(rec + 1, 1) << " id " << le_get(rec + 8, 8)
+                << " amount " << le_get(rec + 16, 8) << " price " << le_get(rec + 24, 8)
+                << " time " << le_get(rec + 32, 8) << std::endl;
+      items = items > 0 ? items - 1 : le_get(rec + 4, 4);
+    }
+    in.erase(0, BIN_FRAME_HEAD + len);
+  }
+  close(sfd);
+  return 0;
+}
+
+
+
 int main (int argc, char** argv) {
+  if (argc == 3 && strcmp(argv[1], "-binary") == 0) {
+    return binary_client(argv[2]);
+  }
+  if (argc > 2 && strcmp(argv[1], "-chunked") == 0) {
+    return chunked_client(argc - 2, argv + 2);
+  }
+  if (argc > 2 && strcmp(argv[1], "-pipelined") == 0) {
+    return pipelined_client(argc - 2, argv + 2);
+  }
+  if (argc > 2 && strcmp(argv[1], "-shm") == 0) {
+    return shm_client(argc - 2, argv + 2, false);
+  }
+  if (argc > 2 && strcmp(argv[1], "-shm-corrupt") == 0) {
+    return shm_client(1, argv + 2, true);
+  }
   clock_t t = clock();
   int threads[MAX_THREAD];
   pthread_attr_t thread_attr[MAX_THREAD];